@@ -4,22 +4,62 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
-#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "zxcvbn.h"
-
-#ifndef ZXCVBN_PASSWORD_LEN_MAX
-#define ZXCVBN_PASSWORD_LEN_MAX 256
-#endif
+#include "zxcvbn_tables.h"
 
 struct zxcvbn_dict;
 
-// prefix tree
+// prefix tree, stored as a double-array: the child of node s by packed
+// character c is node t = base(s) ^ c, valid only if check(t) == s
 struct zxcvbn_node {
-    struct zxcvbn_node **children;
+    int base;
+    int check;
+    int rank;
+};
+
+#define ZXCVBN_NODE_FREE    -1
+#define ZXCVBN_NODE_ROOT    -2
+
+struct zxcvbn_automaton_out {
+    int dict;
     int rank;
 };
 
+/*
+ * Aho-Corasick automaton over all dictionaries. Its goto function is a trie
+ * of the words of every dictionary, the rank of a state is the index of its
+ * first output in outs or -1.
+ */
+struct zxcvbn_automaton {
+    struct zxcvbn_trie trie;
+    int *fail;
+    int *out_link;
+    int *depth;
+    struct zxcvbn_automaton_out *outs;
+    unsigned int n_outs;
+};
+
+/*
+ * Immutable dictionary set. The automaton of a set attached from shared
+ * memory points into map, otherwise it is owned by the set.
+ */
+struct zxcvbn_dict_set {
+    char name[NAME_MAX];
+    uint64_t *control;
+    uint64_t generation;
+    void *map;
+    size_t map_size;
+    struct zxcvbn_automaton automaton;
+};
+
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 #endif
@@ -28,6 +68,10 @@ struct zxcvbn_node {
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
 static inline void *
 __malloc(struct zxcvbn *zxcvbn, size_t size)
 {
@@ -47,33 +91,188 @@ __free(struct zxcvbn *zxcvbn, void *ptr)
 }
 
 static int
-calc_bruteforce_card(const char *password, unsigned int password_len, unsigned int n_symbols)
+calc_bruteforce_card(unsigned int classes, unsigned int n_symbols)
 {
-    int i, digit, lower, upper, symbol;
+    return !!(classes & ZXCVBN_CLASS_DIGIT) * ('9' - '0' + 1) +
+           !!(classes & ZXCVBN_CLASS_LOWER) * ('z' - 'a' + 1) +
+           !!(classes & ZXCVBN_CLASS_UPPER) * ('Z' - 'A' + 1) +
+           !!(classes & ZXCVBN_CLASS_SYMBOL) * n_symbols;
+}
 
-    digit = lower = upper = symbol = 0;
+/* Scratch ================================================================== */
 
-    for (i = 0; i < password_len; ++i) {
-        switch (password[i]) {
-        case '0'...'9':
-            digit = 1;
-            break;
-        case 'a'...'z':
-            lower = 1;
-            break;
-        case 'A'...'Z':
-            upper = 1;
-            break;
-        default:
-            symbol = 1;
-            break;
-        }
+// scratch of passwords up to this length lives on the stack
+#define ZXCVBN_STACK_LEN    256
+
+enum scratch_slot {
+    SCRATCH_ANALYSIS,
+    SCRATCH_ENDS,
+    SCRATCH_ORDER,
+    SCRATCH_MATCHES,
+    SCRATCH_WINDOW,
+    SCRATCH_PATH,
+    SCRATCH_SLOTS,
+};
+
+/* heap scratch of a batch, kept from item to item and grown to the largest */
+struct zxcvbn_scratch {
+    void    *bufs[SCRATCH_SLOTS];
+    size_t  sizes[SCRATCH_SLOTS];
+};
+
+/*
+ * buf if size fits in it, else the slot of the scratch of res or a new block
+ * without one. Contents are not kept when a slot grows.
+ */
+static void *
+scratch_get(struct zxcvbn_res *res, enum scratch_slot slot,
+            void *buf, size_t buf_size, size_t size)
+{
+    struct zxcvbn_scratch *scratch = res->scratch;
+    void *p;
+
+    if (size <= buf_size)
+        return buf;
+    if (scratch == NULL)
+        return __malloc(res->zxcvbn, size);
+
+    if (scratch->sizes[slot] < size) {
+        size = MAX(size, scratch->sizes[slot] * 2);
+        if ((p = __malloc(res->zxcvbn, size)) == NULL)
+            return NULL;
+        if (scratch->bufs[slot] != NULL)
+            __free(res->zxcvbn, scratch->bufs[slot]);
+        scratch->bufs[slot] = p;
+        scratch->sizes[slot] = size;
+    }
+    return scratch->bufs[slot];
+}
+
+static void
+scratch_put(struct zxcvbn_res *res, void *p, void *buf)
+{
+    if (p != NULL && p != buf && res->scratch == NULL)
+        __free(res->zxcvbn, p);
+}
+
+static void
+scratch_release(struct zxcvbn *zxcvbn, struct zxcvbn_scratch *scratch)
+{
+    int slot;
+
+    for (slot = 0; slot < SCRATCH_SLOTS; ++slot) {
+        if (scratch->bufs[slot] != NULL)
+            __free(zxcvbn, scratch->bufs[slot]);
+    }
+}
+
+/* Analysis ================================================================= */
+
+/* per password data shared by the matchers, filled in a single pass */
+struct zxcvbn_analysis {
+    unsigned int    class_mask;
+    uint8_t         *classes;
+    char            *pack;
+    /* length of the run of equal chars and of digits starting at i */
+    uint32_t        *char_runs;
+    uint32_t        *digit_runs;
+    /* number of upper, lower and UTF-8 chars from i to the end */
+    uint32_t        *uppers;
+    uint32_t        *lowers;
+    uint32_t        *utf8_chars;
+    /* columns of a longer password are allocated */
+    void            *block;
+    uint32_t        buf[5 * ZXCVBN_STACK_LEN + 3 + ZXCVBN_STACK_LEN / 2];
+};
+
+#define ANALYSIS_SIZE(n) \
+    ((5 * (n) + 3) * sizeof(uint32_t) + (n) * (sizeof(uint8_t) + sizeof(char)))
+
+#define ANALYSIS_COUNT(analysis, counts, i, j) \
+    ((analysis)->counts[i] - (analysis)->counts[(j) + 1])
+
+static inline char
+pack_char(const struct zxcvbn *zxcvbn, unsigned char ch)
+{
+    return zxcvbn->pack_table[ch | (char_classes[ch] & ZXCVBN_CLASS_UPPER)];
+}
+
+static int
+analysis_init(struct zxcvbn_res *res, struct zxcvbn_analysis *analysis,
+              unsigned int password_len)
+{
+    char *p;
+
+    p = scratch_get(res, SCRATCH_ANALYSIS, analysis->buf, sizeof(analysis->buf),
+                    ANALYSIS_SIZE(password_len));
+    if (p == NULL)
+        return -1;
+    analysis->block = p != (char *) analysis->buf ? p : NULL;
+
+    analysis->char_runs = (uint32_t *) p;
+    p += password_len * sizeof(uint32_t);
+    analysis->digit_runs = (uint32_t *) p;
+    p += password_len * sizeof(uint32_t);
+    analysis->uppers = (uint32_t *) p;
+    p += (password_len + 1) * sizeof(uint32_t);
+    analysis->lowers = (uint32_t *) p;
+    p += (password_len + 1) * sizeof(uint32_t);
+    analysis->utf8_chars = (uint32_t *) p;
+    p += (password_len + 1) * sizeof(uint32_t);
+    analysis->classes = (uint8_t *) p;
+    p += password_len * sizeof(uint8_t);
+    analysis->pack = p;
+
+    return 0;
+}
+
+static void
+analysis_release(struct zxcvbn_res *res, struct zxcvbn_analysis *analysis)
+{
+    scratch_put(res, analysis->block, NULL);
+}
+
+static int
+analyze(struct zxcvbn_res *res, struct zxcvbn_analysis *analysis,
+        const char *password, unsigned int password_len)
+{
+    struct zxcvbn *zxcvbn = res->zxcvbn;
+    unsigned int i, class, mask = 0, run = 0, digit_run = 0;
+    unsigned char ch, next = 0;
+
+    if (analysis_init(res, analysis, password_len) < 0)
+        return -1;
+
+    analysis->uppers[password_len] = 0;
+    analysis->lowers[password_len] = 0;
+    analysis->utf8_chars[password_len] = 0;
+
+    for (i = password_len; i-- > 0; next = ch) {
+        ch = password[i];
+        class = char_classes[ch];
+        analysis->classes[i] = class;
+        analysis->pack[i] = pack_char(zxcvbn, ch);
+        mask |= class;
+
+        run = (i + 1 < password_len && ch == next) ? run + 1 : 1;
+        digit_run = (class & ZXCVBN_CLASS_DIGIT) ? digit_run + 1 : 0;
+        analysis->char_runs[i] = run;
+        analysis->digit_runs[i] = digit_run;
+
+        analysis->uppers[i] = analysis->uppers[i + 1] +
+                              !!(class & ZXCVBN_CLASS_UPPER);
+        analysis->lowers[i] = analysis->lowers[i + 1] +
+                              !!(class & ZXCVBN_CLASS_LOWER);
+        analysis->utf8_chars[i] = analysis->utf8_chars[i + 1] +
+                                  ((ch & 0xc0) != 0x80);
     }
-    return digit * ('9' - '0' + 1) +
-           lower * ('z' - 'a' + 1) +
-           upper * ('Z' - 'A' + 1) + symbol * n_symbols;
+    analysis->class_mask = mask;
+
+    return 0;
 }
 
+/* Analysis ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
 const char *
 zxcvbn_match_type_string(enum zxcvbn_match_type type)
 {
@@ -92,336 +291,468 @@ zxcvbn_match_type_string(enum zxcvbn_match_type type)
         return "repeat";
     case ZXCVBN_MATCH_TYPE_BRUTEFORCE:
         return "bruteforce";
+    case ZXCVBN_MATCH_TYPE_BREACH:
+        return "breach";
     default:
         assert(0);
     }
 }
 
-static unsigned int
-get_align_coords(int coords[2][8], int x, int y)
+// columns of n candidates at block, the widest come first to stay aligned
+static void
+candidates_layout(struct zxcvbn_candidates *cands, void *block, unsigned int n)
 {
-    coords[0][0] = x - 1;
-    coords[1][0] = y;
-
-    coords[0][1] = x - 1;
-    coords[1][1] = y - 1;
-
-    coords[0][2] = x;
-    coords[1][2] = y - 1;
-
-    coords[0][3] = x + 1;
-    coords[1][3] = y - 1;
-
-    coords[0][4] = x + 1;
-    coords[1][4] = y;
-
-    coords[0][5] = x + 1;
-    coords[1][5] = y + 1;
-
-    coords[0][6] = x;
-    coords[1][6] = y + 1;
-
-    coords[0][7] = x - 1;
-    coords[1][7] = y + 1;
-
-    return 8;
+    char *p = block;
+
+    cands->entropy = (double *) p;
+    p += n * sizeof(*cands->entropy);
+    cands->aux = (union zxcvbn_candidate_aux *) p;
+    p += n * sizeof(*cands->aux);
+    cands->i = (uint32_t *) p;
+    p += n * sizeof(*cands->i);
+    cands->j = (uint32_t *) p;
+    p += n * sizeof(*cands->j);
+    cands->type = (uint8_t *) p;
+    p += n * sizeof(*cands->type);
+    cands->flags = (uint8_t *) p;
+    cands->n_reserved = n;
 }
 
-static unsigned int
-get_slant_coords(int coords[2][8], int x, int y)
+static inline int
+candidates_on_heap(const struct zxcvbn_res *res)
 {
-    coords[0][0] = x - 1;
-    coords[1][0] = y;
-
-    coords[0][1] = x;
-    coords[1][1] = y - 1;
-
-    coords[0][2] = x + 1;
-    coords[1][2] = y - 1;
-
-    coords[0][3] = x + 1;
-    coords[1][3] = y;
-
-    coords[0][4] = x;
-    coords[1][4] = y + 1;
+    void *block = res->candidates.entropy;
 
-    coords[0][5] = x - 1;
-    coords[1][5] = y + 1;
+    return block != res->candidate_buf && block != res->arena;
+}
 
-    return 6;
+void
+zxcvbn_res_init(struct zxcvbn_res *res, struct zxcvbn *zxcvbn)
+{
+    res->zxcvbn = zxcvbn;
+    res->arena = NULL;
+    res->scratch = NULL;
+    candidates_layout(&res->candidates, res->candidate_buf,
+                      sizeof(res->candidate_buf) / ZXCVBN_CANDIDATE_SIZE);
+    res->candidates.n = 0;
+    res->matches = res->match_buf;
+    res->n_matches = 0;
+    res->n_matches_reserved = ARRAY_SIZE(res->match_buf);
+    // counters are bumped even with stats disabled, only never read
+    memset(&res->stats, 0, sizeof(res->stats));
 }
 
-static void
-make_spatial_graph_iter(struct zxcvbn_spatial_graph *spatial_graph,
-                        const char **kb,
-                        unsigned int x_size, unsigned int y_size,
-                        unsigned int token_size, unsigned int n_coords,
-                        unsigned int get_coords(int coords[2][8], int x, int y))
+void
+zxcvbn_res_init_arena(struct zxcvbn_res *res, struct zxcvbn *zxcvbn,
+                      void *buf, size_t size)
 {
-#define  KB_XY(x, y) ((void *) kb[x_size *y + x])
+    uintptr_t align, start;
+    size_t n;
 
-    int x, y, i, coords[2][8], n_coords_get;
-    const unsigned char *s;
+    zxcvbn_res_init(res, zxcvbn);
 
-    assert(y_size >= 2);
+    align = MAX(__alignof__(double), __alignof__(union zxcvbn_candidate_aux));
+    start = ((uintptr_t) buf + align - 1) & ~(align - 1);
+    if (buf == NULL || start - (uintptr_t) buf >= size)
+        return;
+    n = (size - (start - (uintptr_t) buf)) / ZXCVBN_CANDIDATE_SIZE;
+    if (n <= res->candidates.n_reserved)
+        return;
 
-    spatial_graph->token_size = token_size;
-    spatial_graph->n_coords = n_coords + 1;
+    res->arena = (void *) start;
+    candidates_layout(&res->candidates, res->arena, MIN(n, UINT_MAX));
+}
 
-    for (y = 1; y < y_size - 1; ++y) {
-        for (x = 1; x < x_size - 1; ++x) {
-            if ((s = KB_XY(x, y)) == NULL)
-                continue;
+void
+zxcvbn_res_reset(struct zxcvbn_res *res)
+{
+    res->candidates.n = 0;
+    res->n_matches = 0;
+}
 
-            n_coords_get = get_coords(coords, x, y);
-            assert(n_coords_get == n_coords);
-            for (; *s != '\0'; ++s) {
-                ++spatial_graph->n_chars;
-                for (i = 0; i < n_coords; ++i)
-                    if ((spatial_graph->data[*s][i] = KB_XY(coords[0][i], coords[1][i])) != NULL)
-                        ++spatial_graph->degree;
-                spatial_graph->data[*s][n_coords] = KB_XY(x, y);
-            } 
-        }
-    }
+void
+zxcvbn_res_release(struct zxcvbn_res *res)
+{
+    if (candidates_on_heap(res))
+        __free(res->zxcvbn, res->candidates.entropy);
+    if (res->matches != res->match_buf)
+        __free(res->zxcvbn, res->matches);
+}
 
-    for (y = 0; y < 256; ++y) {
-        for (x = 0; x < spatial_graph->n_coords; ++x) {
-            if (spatial_graph->data[y][x] == NULL)
-                spatial_graph->data[y][x] = (void *) "\xff\xff";
+// index of a new candidate, its aux and entropy are left for the caller
+static int
+candidate_add(struct zxcvbn_res *res, enum zxcvbn_match_type type,
+              unsigned int i, unsigned int j, unsigned int flags)
+{
+    struct zxcvbn_candidates *cands = &res->candidates, old;
+    unsigned int n_reserved;
+    int on_heap;
+    void *block;
+
+    if (cands->n == cands->n_reserved) {
+        n_reserved = cands->n_reserved * 2;
+        if (res->zxcvbn->max_matches_num) {
+            if (cands->n_reserved >= res->zxcvbn->max_matches_num)
+                return -1;
+            n_reserved = MIN(n_reserved, res->zxcvbn->max_matches_num);
         }
+        if ((block = __malloc(res->zxcvbn, n_reserved * ZXCVBN_CANDIDATE_SIZE)) == NULL)
+            return -1;
+        res->stats.reallocs++;
+        old = *cands;
+        on_heap = candidates_on_heap(res);
+        candidates_layout(cands, block, n_reserved);
+        memcpy(cands->entropy, old.entropy, old.n * sizeof(*old.entropy));
+        memcpy(cands->aux, old.aux, old.n * sizeof(*old.aux));
+        memcpy(cands->i, old.i, old.n * sizeof(*old.i));
+        memcpy(cands->j, old.j, old.n * sizeof(*old.j));
+        memcpy(cands->type, old.type, old.n * sizeof(*old.type));
+        memcpy(cands->flags, old.flags, old.n * sizeof(*old.flags));
+        if (on_heap)
+            __free(res->zxcvbn, old.entropy);
     }
 
-    spatial_graph->degree /= spatial_graph->n_chars;
-
-#undef KB_XY
+    cands->i[cands->n] = i;
+    cands->j[cands->n] = j;
+    cands->type[cands->n] = type;
+    cands->flags[cands->n] = flags;
+    return cands->n++;
 }
 
-static void
-make_spatial_graph(struct zxcvbn *zxcvbn)
-{
-#define KEYBRD_X_SIZE 16
-#define KEYBRD_Y_SIZE 6
-#define KEYPAD_X_SIZE 6
-#define KEYPAD_Y_SIZE 7
-
-    static const char *qwerty[KEYBRD_Y_SIZE][KEYBRD_X_SIZE] = {
-        { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,  NULL, NULL,  NULL },
-        { NULL, "`~", "1!", "2@", "3#", "4$", "5%", "6^", "7&", "8*", "9(", "0)", "-_",  "=+", NULL,  NULL },
-        { NULL, NULL, "qQ", "wW", "eE", "rR", "tT", "yY", "uU", "iI", "oO", "pP", "[{",  "]}", "\\|", NULL },
-        { NULL, NULL, "aA", "sS", "dD", "fF", "gG", "hH", "jJ", "kK", "lL", ";:", "'\"", NULL, NULL,  NULL }, 
-        { NULL, NULL, "zZ", "xX", "cC", "vV", "bB", "nN", "mM", ",<", ".>", "/?", NULL,  NULL, NULL,  NULL },
-        { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,  NULL, NULL,  NULL }
-    };
-
-    static const char *dvorak[KEYBRD_Y_SIZE][KEYBRD_X_SIZE] = {
-        { NULL, NULL, NULL,  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,  NULL, },
-        { NULL, "`~", "1!",  "2@", "3#", "4$", "5%", "6^", "7&", "8*", "9(", "0)", "[{", "]}", NULL,  NULL, },
-        { NULL, NULL, "'\"", ",<", ".>", "pP", "yY", "fF", "gG", "cC", "rR", "lL", "/?", "=+", "\\|", NULL, },
-        { NULL, NULL, "aA",  "oO", "eE", "uU", "iI", "dD", "hH", "tT", "nN", "sS", "-_", NULL, NULL,  NULL, },
-        { NULL, NULL, ";:",  "qQ", "jJ", "kK", "xX", "bB", "mM", "wW", "vV", "zZ", NULL, NULL, NULL,  NULL, },
-        { NULL, NULL, NULL,  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,  NULL, },
-    };
-
-    static const char *keypad[KEYPAD_Y_SIZE][KEYPAD_X_SIZE] = {
-        { NULL, NULL, NULL, NULL, NULL, NULL, },
-        { NULL, NULL, "/",  "*",  "-",  NULL, },
-        { NULL, "7",  "8",  "9",  "+",  NULL, },
-        { NULL, "4",  "5",  "6",  NULL, NULL, },
-        { NULL, "1",  "2",  "3",  NULL, NULL, },
-        { NULL, NULL, "0",  ".",  NULL, NULL, },
-        { NULL, NULL, NULL, NULL, NULL, NULL, },
-    };
-
-    static const char *macpad[KEYPAD_Y_SIZE][KEYPAD_X_SIZE] = {
-        { NULL, NULL, NULL, NULL, NULL, NULL, },
-        { NULL, NULL, "=",  "/",  "*",  NULL, },
-        { NULL, "7",  "8",  "9",  "-",  NULL, },
-        { NULL, "4",  "5",  "6",  "+",  NULL, },
-        { NULL, "1",  "2",  "3",  NULL, NULL, },
-        { NULL, "0",  ".",  NULL, NULL, NULL, },
-        { NULL, NULL, NULL, NULL, NULL, NULL, },
-    };
-
-    make_spatial_graph_iter(&zxcvbn->spatial_graph_qwerty,
-                            (const char **) qwerty,
-                            KEYBRD_X_SIZE, KEYBRD_Y_SIZE, 2, 6, get_slant_coords);
-
-    make_spatial_graph_iter(&zxcvbn->spatial_graph_dvorak,
-                            (const char **) dvorak,
-                            KEYBRD_X_SIZE, KEYBRD_Y_SIZE, 2, 6, get_slant_coords);
+static int
+push_match(struct zxcvbn_res *res,
+           enum zxcvbn_match_type type, const struct zxcvbn_spatial_graph *spatial_graph,
+           unsigned int i, unsigned int j, unsigned int turns, unsigned int shifted)
+{
+    union zxcvbn_candidate_aux *aux;
+    int k;
 
-    make_spatial_graph_iter(&zxcvbn->spatial_graph_keypad,
-                            (const char **) keypad,
-                            KEYPAD_X_SIZE, KEYPAD_Y_SIZE, 1, 8, get_align_coords);
+    if ((k = candidate_add(res, type, i, j, 0)) < 0)
+        return -1;
 
-    make_spatial_graph_iter(&zxcvbn->spatial_graph_macpad,
-                            (const char **) macpad,
-                            KEYPAD_X_SIZE, KEYPAD_Y_SIZE, 1, 8, get_align_coords);
+    aux = res->candidates.aux + k;
+    aux->spatial.graph = spatial_graph;
+    aux->spatial.turns = turns;
+    aux->spatial.shifted = shifted;
 
-#undef KEYBRD_X_SIZE
-#undef KEYBRD_Y_SIZE
-#undef KEYPAD_X_SIZE
-#undef KEYPAD_Y_SIZE
+    return k;
 }
 
-void
-zxcvbn_res_init(struct zxcvbn_res *res, struct zxcvbn *zxcvbn)
+static int
+push_match_dict(struct zxcvbn_res *res, unsigned int i, unsigned int j, unsigned int rank)
 {
-    res->zxcvbn = zxcvbn;
-    res->n_matches = 0;
-    res->matches = res->match_buf;
-    res->n_matches_reserved = ARRAY_SIZE(res->match_buf);
-}
+    int k;
 
-void
-zxcvbn_res_release(struct zxcvbn_res *res)
-{
-    if (res->matches != res->match_buf)
-        __free(res->zxcvbn, res->matches);
+    if ((k = candidate_add(res, ZXCVBN_MATCH_TYPE_DICT, i, j, 0)) < 0)
+        return -1;
+
+    res->candidates.aux[k].rank = rank;
+
+    return k;
 }
 
+// matches of the lowest entropy path, filled in when the path is known
 static struct zxcvbn_match *
 match_add(struct zxcvbn_res *res)
 {
-    size_t size;
+    struct zxcvbn_match *matches;
+    unsigned int n_reserved;
+
     if (res->n_matches_reserved == res->n_matches) {
-        if (!res->zxcvbn->max_matches_num)
-            res->n_matches_reserved += ARRAY_SIZE(res->match_buf);
-        else {
-            if (res->n_matches_reserved >= res->zxcvbn->max_matches_num)
-                return NULL;
-            res->n_matches_reserved =
-                    MIN(res->n_matches_reserved + ARRAY_SIZE(res->match_buf),
-                        res->zxcvbn->max_matches_num);
-        }
-        size = sizeof(struct zxcvbn_match) * res->n_matches_reserved;
+        n_reserved = res->n_matches_reserved * 2;
         if (res->matches == res->match_buf) {
-            if ((res->matches = __malloc(res->zxcvbn, size)) == NULL)
+            matches = __malloc(res->zxcvbn, sizeof(*matches) * n_reserved);
+            if (matches == NULL)
                 return NULL;
-            memcpy(res->matches, res->match_buf, sizeof(res->match_buf));
+            memcpy(matches, res->matches, sizeof(*matches) * res->n_matches);
         } else {
-            if ((res->matches = __realloc(res->zxcvbn, res->matches, size)) == NULL)
+            matches = __realloc(res->zxcvbn, res->matches,
+                                sizeof(*matches) * n_reserved);
+            if (matches == NULL)
                 return NULL;
         }
+        res->matches = matches;
+        res->n_matches_reserved = n_reserved;
+        res->stats.reallocs++;
     }
 
     return res->matches + res->n_matches++;
 }
 
+static void
+match_fill(struct zxcvbn_match *match, const struct zxcvbn_candidates *cands,
+           unsigned int k)
+{
+    const union zxcvbn_candidate_aux *aux = cands->aux + k;
+
+    match->type = cands->type[k];
+    match->i = cands->i[k];
+    match->j = cands->j[k];
+    match->flags = cands->flags[k];
+    match->entropy = cands->entropy[k];
+    match->spatial_graph = NULL;
+    match->turns = 0;
+    match->shifted = 0;
+    match->rank = 0;
+
+    switch (match->type) {
+    case ZXCVBN_MATCH_TYPE_DICT:
+    case ZXCVBN_MATCH_TYPE_BREACH:
+        match->rank = aux->rank;
+        break;
+    case ZXCVBN_MATCH_TYPE_SPATIAL:
+        match->spatial_graph = aux->spatial.graph;
+        match->turns = aux->spatial.turns;
+        match->shifted = aux->spatial.shifted;
+        break;
+    case ZXCVBN_MATCH_TYPE_SEQUENCE:
+        match->seq = aux->seq;
+        break;
+    case ZXCVBN_MATCH_TYPE_DATE:
+        match->date = aux->date;
+        break;
+    default:
+        break;
+    }
+}
+
 static struct zxcvbn_match *
-push_match(struct zxcvbn_res *res,
-           enum zxcvbn_match_type type, struct zxcvbn_spatial_graph *spatial_graph,
-           unsigned int i, unsigned int j, unsigned int turns, unsigned int shifted)
+push_match_bruteforce(struct zxcvbn_res *res,
+                      unsigned int i, unsigned int j, unsigned int bruteforce_card)
 {
     struct zxcvbn_match *match;
 
     if ((match = match_add(res)) == NULL)
         return NULL;
 
-    match->type = type;
-    match->spatial_graph = spatial_graph;
+    match->type = ZXCVBN_MATCH_TYPE_BRUTEFORCE;
+    match->spatial_graph = NULL;
+    match->flags = 0;
     match->i = i;
     match->j = j;
-    match->turns = turns;
-    match->shifted = shifted;
+    match->turns = 0;
+    match->shifted = 0;
+    match->rank = 0;
+    match->entropy = log2(pow(bruteforce_card, j - i + 1));
+    // pow() overflows on gaps of long passwords
+    if (isinf(match->entropy))
+        match->entropy = (j - i + 1) * log2(bruteforce_card);
 
     return match;
 }
 
-static struct zxcvbn_match *
-push_match_dict(struct zxcvbn_res *res, unsigned int i, unsigned int j, unsigned int rank)
+#define UTF8_INVALID    0xffffffff
+
+// code of the UTF-8 char at str and its length in n, a byte not starting a
+// valid char is a char of its own
+static uint32_t
+utf8_decode(const char *str, unsigned int len, unsigned int *n)
 {
-    struct zxcvbn_match *match;
+    const unsigned char *s;
+    unsigned int i, k;
+    uint32_t ch;
+
+    s = (const unsigned char *) str;
+    *n = 1;
+    if (s[0] < 0x80)
+        return s[0];
+    else if (s[0] >= 0xc2 && s[0] < 0xe0) {
+        k = 1;
+        ch = s[0] & 0x1f;
+    } else if (s[0] >= 0xe0 && s[0] < 0xf0) {
+        k = 2;
+        ch = s[0] & 0x0f;
+    } else if (s[0] >= 0xf0 && s[0] < 0xf5) {
+        k = 3;
+        ch = s[0] & 0x07;
+    } else
+        return UTF8_INVALID;
+
+    if (k >= len)
+        return UTF8_INVALID;
+    for (i = 1; i <= k; ++i) {
+        if ((s[i] & 0xc0) != 0x80)
+            return UTF8_INVALID;
+        ch = ch << 6 | (s[i] & 0x3f);
+    }
 
-    if ((match = match_add(res)) == NULL)
-        return NULL;
+    *n = k + 1;
+    return ch;
+}
 
-    match->type = ZXCVBN_MATCH_TYPE_DICT;
-    match->i = i;
-    match->j = j;
-    match->rank = rank;
+static inline unsigned int
+spatial_key(const struct zxcvbn_spatial_graph *spatial_graph, uint32_t ch)
+{
+    const struct zxcvbn_spatial_key *keys;
+    unsigned int lo, hi, mid;
+
+    if (ch < ARRAY_SIZE(spatial_graph->keys))
+        return spatial_graph->keys[ch];
+
+    keys = spatial_graph->wide_keys;
+    lo = 0;
+    hi = spatial_graph->n_wide_keys;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (keys[mid].ch < ch)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
-    return match;
+    if (lo < spatial_graph->n_wide_keys && keys[lo].ch == ch)
+        return keys[lo].key;
+    return ZXCVBN_KEY_NONE;
 }
 
-static struct zxcvbn_match *
-push_match_bruteforce(struct zxcvbn_res *res,
-                      unsigned int i, unsigned int j, unsigned int bruteforce_card)
+// mask of active layouts having ch
+static inline uint32_t
+spatial_layouts(const struct zxcvbn *zxcvbn, uint32_t ch)
 {
-    struct zxcvbn_match *match;
+    uint32_t mask, todo;
+    unsigned int g;
 
-    if ((match = match_add(res)) == NULL)
-        return NULL;
+    if (ch < ARRAY_SIZE(zxcvbn->layout_masks))
+        return zxcvbn->layout_masks[ch];
 
-    match->type = ZXCVBN_MATCH_TYPE_BRUTEFORCE;
-    match->i = i;
-    match->j = j;
-    match->entropy = log2(pow(bruteforce_card, j - i + 1));
+    mask = 0;
+    for (todo = zxcvbn->wide_layouts; todo; todo &= todo - 1) {
+        g = __builtin_ctz(todo);
+        if (spatial_key(zxcvbn->layouts[g], ch) != ZXCVBN_KEY_NONE)
+            mask |= (uint32_t) 1 << g;
+    }
 
-    return match;
+    return mask;
 }
 
-static int
-match_spatial_iter(struct zxcvbn_res *res,
-                   const char *password, unsigned int password_len, struct zxcvbn_spatial_graph *spatial_graph)
-{
-    int i, j, cur_dir, prv_dir, turns, shifted;
-    unsigned char cur, prv;
-    const unsigned char *s, *p;
-
-    i = j = 0;
-    prv_dir = -1;
-    turns = 0;
-    shifted = 0;
-    
-    while (i + 2 < password_len) {
-        prv = password[j];
-        ++j;
-        if (j < password_len) {
-            cur = password[j];
-
-            for (cur_dir = 0; cur_dir < spatial_graph->n_coords; ++cur_dir) {
-                s = (void *) spatial_graph->data[prv][cur_dir];
-                for (p = s; p - s < spatial_graph->token_size; ++p) {
-                    if (*p == cur) {
-                        shifted += p != s;
-                        if (cur_dir != prv_dir) {
-                            ++turns;
-                            prv_dir = cur_dir;
-                        }
-                        continue;
-                    }
-                }
-            }
-        }
+// direction from key a to key b or -1, shifted is set if b is typed with shift
+static inline int
+spatial_direction(const struct zxcvbn_spatial_graph *spatial_graph,
+                  unsigned int a, unsigned int b, unsigned int *shifted)
+{
+    unsigned int dx, dy;
 
-        if (j - i > 2) {
-            if (push_match(res, ZXCVBN_MATCH_TYPE_SPATIAL, spatial_graph, i, j - 1, turns, shifted) == NULL)
-                return -1;
-        }
+    if (a == ZXCVBN_KEY_NONE || b == ZXCVBN_KEY_NONE)
+        return -1;
 
-        i = j;
-        prv_dir = -1;
-        turns = 0;
-        shifted = 0;
-    }
- 
-    return 0;
+    dx = (b & 0xf) - (a & 0xf) + 1;
+    dy = ((b >> 4) & 0x7) - ((a >> 4) & 0x7) + 1;
+    if (dx > 2 || dy > 2)
+        return -1;
+
+    *shifted = (b & ZXCVBN_KEY_SHIFTED) != 0;
+    return spatial_graph->directions[dy][dx];
 }
 
+/*
+ * Walks of adjacent keys on all active layouts are followed in a single pass,
+ * a char is only looked up on the layouts having it and the previous char or
+ * walking. A walk of at least 3 chars is a match, turns counts changes of
+ * direction. If fresh is given, fresh[k] is the last char up to byte k after
+ * which no walk was under way, a pass starting there finds the same matches.
+ */
 static int
-match_spatial(struct zxcvbn_res *res, const char *password, unsigned int password_len)
+match_spatial(struct zxcvbn_res *res, const char *password, unsigned int password_len,
+              unsigned int *fresh)
 {
     struct zxcvbn *zxcvbn;
+    const struct zxcvbn_spatial_graph *spatial_graph;
+    struct {
+        unsigned int i;
+        unsigned int length;
+        int dir;
+        unsigned int turns;
+        unsigned int shifted;
+    } walks[ZXCVBN_LAYOUTS_MAX], *walk;
+    uint32_t prv, cur, prv_mask, cur_mask, both, walking, todo, bit;
+    unsigned int g, i, j, k, n, shifted, last;
+    int dir;
 
     zxcvbn = res->zxcvbn;
+    prv = UTF8_INVALID;
+    prv_mask = 0;
+    walking = 0;
+    i = 0;
+    last = 0;
 
-    if (match_spatial_iter(res, password, password_len, &zxcvbn->spatial_graph_qwerty) ||
-        match_spatial_iter(res, password, password_len, &zxcvbn->spatial_graph_dvorak) ||
-        match_spatial_iter(res, password, password_len, &zxcvbn->spatial_graph_keypad) ||
-        match_spatial_iter(res, password, password_len, &zxcvbn->spatial_graph_macpad))
-        return -1;
+    for (j = 0; j <= password_len; j += n) {
+        cur = UTF8_INVALID;
+        cur_mask = 0;
+        n = 1;
+        if (j < password_len) {
+            cur = utf8_decode(password + j, password_len - j, &n);
+            cur_mask = spatial_layouts(zxcvbn, cur);
+        }
+
+        both = prv_mask & cur_mask;
+        for (todo = walking | both; todo; todo &= todo - 1) {
+            g = __builtin_ctz(todo);
+            bit = (uint32_t) 1 << g;
+            spatial_graph = zxcvbn->layouts[g];
+            walk = walks + g;
+
+            dir = -1;
+            if (both & bit)
+                dir = spatial_direction(spatial_graph, spatial_key(spatial_graph, prv),
+                                        spatial_key(spatial_graph, cur), &shifted);
+
+            // a walk as long as a match can be ends, the next one starts at cur
+            if (dir >= 0 && (walking & bit) && walk->length == ZXCVBN_MATCH_SPAN_MAX) {
+                if (push_match(res, ZXCVBN_MATCH_TYPE_SPATIAL, spatial_graph,
+                               walk->i, j - 1, walk->turns, walk->shifted) < 0)
+                    return -1;
+                walk->i = j;
+                walk->length = 1;
+                walk->dir = -1;
+                walk->turns = 0;
+                walk->shifted = 0;
+                continue;
+            }
+
+            if (dir >= 0) {
+                if (!(walking & bit)) {
+                    walking |= bit;
+                    walk->i = i;
+                    walk->length = 1;
+                    walk->dir = -1;
+                    walk->turns = 0;
+                    walk->shifted = 0;
+                }
+                ++walk->length;
+                walk->shifted += shifted;
+                if (dir != walk->dir) {
+                    ++walk->turns;
+                    walk->dir = dir;
+                }
+                continue;
+            }
+
+            if (!(walking & bit))
+                continue;
+            walking &= ~bit;
+            if (walk->length > 2) {
+                if (push_match(res, ZXCVBN_MATCH_TYPE_SPATIAL, spatial_graph,
+                               walk->i, j - 1, walk->turns, walk->shifted) < 0)
+                    return -1;
+            }
+        }
+
+        // a walk restarted at cur is as good as none
+        if (fresh != NULL && j < password_len) {
+            for (todo = walking; todo; todo &= todo - 1) {
+                if (walks[__builtin_ctz(todo)].length > 1)
+                    break;
+            }
+            for (k = j; k + 1 < j + n; ++k)
+                fresh[k] = last;
+            last = todo ? last : j;
+            fresh[k] = last;
+        }
+
+        prv = cur;
+        prv_mask = cur_mask;
+        i = j;
+    }
 
     return 0;
 }
@@ -430,19 +761,17 @@ match_spatial(struct zxcvbn_res *res, const char *password, unsigned int passwor
 
 static int8_t
 zxcvbn_repeat_match(struct zxcvbn_res *res,
-                    char *password, uint32_t password_len)
+                    const struct zxcvbn_analysis *analysis,
+                    uint32_t password_len)
 {
-    char ch;
     uint32_t i, j;
 
     i = 0;
     while (i + 1 < password_len) {
-        ch = password[i];
-        for (j = i + 1; j < password_len && password[j] == ch; j++)
-            {;}
+        j = i + MIN(analysis->char_runs[i], ZXCVBN_MATCH_SPAN_MAX);
         if (j - i > 2) {
-            if (!push_match(res, ZXCVBN_MATCH_TYPE_REPEAT,
-                            NULL, i, j - 1, 0, 0))
+            if (push_match(res, ZXCVBN_MATCH_TYPE_REPEAT,
+                           NULL, i, j - 1, 0, 0) < 0)
                 return -1;
         }
         i = j;
@@ -450,81 +779,66 @@ zxcvbn_repeat_match(struct zxcvbn_res *res,
     return 0;
 }
 
-static void
+static double
 zxcvbn_repeat_calculate_entropy(struct zxcvbn *zxcvbn,
-                                struct zxcvbn_match *match,
-                                char *password, uint32_t password_len)
+                                const struct zxcvbn_candidates *cands, unsigned int k,
+                                const struct zxcvbn_analysis *analysis)
 {
-    match->entropy = log2(calc_bruteforce_card(password + match->i, 1,
-                                               zxcvbn->n_symbols) *
-                          (match->j - match->i + 1));
+    return log2(calc_bruteforce_card(analysis->classes[cands->i[k]],
+                                     zxcvbn->n_symbols) *
+                (cands->j[k] - cands->i[k] + 1));
 }
 
 /* Repeat ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
 
 /* Sequence ================================================================= */
 
-#define ZXCVBN_SEQUENCES_DEF(m) \
-    m("abcdefghijklmnopqrstuvwxyz", 0)          \
-    m("ABCDEFGHIJKLMNOPQRSTUVWXYZ", 1)          \
-    m("f,dult;pbqrkvyjghcnea[wxio]sm'.z", 1)    \
-    m("F<DULT:PBQRKVYJGHCNEA{WXIO}SM\">Z", 2)   \
-    m("abvgdegziyklmnoprstufhc", 1)             \
-    m("ABVGDEGZIYKLMNOPRSTUFHC", 2)             \
-    m("0123456789", 0)                          \
-
 #define ZXCVBN_SEQUENCE_OBVIOUS_START   "aAzZfF019"
 #define ZXCVBN_SEQUENCE_MIN_LEN         3
 
-struct zxcvbn_sequence {
-    char           *str;
-    unsigned int    len;
-    unsigned int    extra_entropy;
-};
-
-static struct zxcvbn_sequence zxcvbn_sequences[] = {
-#define ZXCVBN_M(s,e)   {s, sizeof(s) - 1, e},
-    ZXCVBN_SEQUENCES_DEF(ZXCVBN_M)
-#undef ZXCVBN_M
-};
-
-static struct zxcvbn_match *
+static int
 zxcvbn_sequence_add_match(struct zxcvbn_res *res, uint32_t i, uint32_t j,
-                          struct zxcvbn_sequence *seq, int8_t dir)
+                          const struct zxcvbn_sequence *seq, int8_t dir)
 {
-    struct zxcvbn_match *match;
+    int k;
 
-    if (!(match = match_add(res)))
-        return NULL;
+    k = candidate_add(res, ZXCVBN_MATCH_TYPE_SEQUENCE, i, j,
+                      dir == -1 ? ZXCVBN_MATCH_DESC_SEQ : 0);
+    if (k < 0)
+        return -1;
 
-    match->type = ZXCVBN_MATCH_TYPE_SEQUENCE;
-    match->i = i;
-    match->j = j;
-    match->seq = seq;
-    match->flags |= (dir == -1 ? ZXCVBN_MATCH_DESC_SEQ : 0);
-    return match;
+    res->candidates.aux[k].seq = seq;
+    return k;
 }
 
+/*
+ * Sequences are found by the index of chars in each alphabet, the first
+ * alphabet having both of the first two chars next to each other wins.
+ * If steps is given, steps[k] is where the step over char k started.
+ */
 static int8_t
 zxcvbn_sequence_match(struct zxcvbn_res *res,
-                      char *password, uint32_t password_len)
+                      const char *password, uint32_t password_len,
+                      uint32_t *steps)
 {
-    struct zxcvbn_sequence *seq;
-    uint32_t i, j, s, i_n, j_n, prev_n;
+    const struct zxcvbn_sequence *seq;
+    const unsigned char *p;
+    const uint32_t *masks;
+    uint32_t i, j, s, i_n, j_n, prev_n, candidates;
     int32_t dir;
-    char *p;
+
+    p = (const unsigned char *) password;
+    masks = res->zxcvbn->sequence_masks;
 
     i = 0;
     while (i + ZXCVBN_SEQUENCE_MIN_LEN - 1 < password_len) {
         j = i + 1;
-        for (s = 0; s < ARRAY_SIZE(zxcvbn_sequences); s++) {
-            seq = zxcvbn_sequences + s;
-            if (!(p = strchr(seq->str, password[i])))
-                continue;
-            i_n = p - seq->str;
-            if (!(p = strchr(seq->str, password[j])))
-                continue;
-            j_n = p - seq->str;
+        dir = 0;
+        for (candidates = masks[p[i]] & masks[p[j]]; candidates; candidates &= candidates - 1) {
+            s = __builtin_ctz(candidates);
+            seq = res->zxcvbn->sequences[s];
+            i_n = seq->index[p[i]];
+            j_n = seq->index[p[j]];
             if ((i_n + 1) % seq->len == j_n) {
                 dir = 1;
                 break;
@@ -533,62 +847,112 @@ zxcvbn_sequence_match(struct zxcvbn_res *res,
                 break;
             }
         }
-        if (s == ARRAY_SIZE(zxcvbn_sequences)) {
+        if (dir == 0) {
+            if (steps != NULL)
+                steps[i] = i;
             i++;
             continue;
         }
 
         j++;
-        while (j < password_len) {
-            p = strchr(seq->str, password[j]);
-            if (!p)
+        while (j < password_len && j - i < ZXCVBN_MATCH_SPAN_MAX) {
+            if (seq->index[p[j]] == ZXCVBN_SEQUENCE_NONE)
                 break;
             prev_n = j_n;
-            j_n = p - seq->str;
+            j_n = seq->index[p[j]];
             if (j_n != (seq->len + prev_n + dir) % seq->len)
                 break;
             j++;
         }
 
         if (j - i >= ZXCVBN_SEQUENCE_MIN_LEN) {
-            if (!zxcvbn_sequence_add_match(res, i, j, seq, dir))
+            if (zxcvbn_sequence_add_match(res, i, j, seq, dir) < 0)
                 return -1;
         }
+        for (s = i; steps != NULL && s < j; ++s)
+            steps[s] = i;
         i = j;
     }
+    for (s = i; steps != NULL && s < password_len; ++s)
+        steps[s] = i;
     return 0;
 }
 
-static void
+// alphabets of opts, the built in masks are copied
+static int
+sequences_add(struct zxcvbn *zxcvbn, const char *const *strs, unsigned int n_strs)
+{
+    struct zxcvbn_sequence *seq;
+    uint32_t *masks;
+    unsigned int i, k, len;
+
+    if ((masks = __malloc(zxcvbn, sizeof(sequence_masks))) == NULL)
+        return -1;
+    memcpy(masks, sequence_masks, sizeof(sequence_masks));
+
+    for (i = 0; i < n_strs; ++i) {
+        len = strlen(strs[i]);
+        if (zxcvbn->n_sequences == ZXCVBN_SEQUENCES_MAX || len < 2 || len >= ZXCVBN_SEQUENCE_NONE)
+            goto error;
+        if ((seq = __malloc(zxcvbn, sizeof(*seq) + len + 1)) == NULL)
+            goto error;
+
+        memcpy(seq + 1, strs[i], len + 1);
+        seq->str = (const char *) (seq + 1);
+        seq->len = len;
+        seq->extra_entropy = 1;
+        memset(seq->index, ZXCVBN_SEQUENCE_NONE, sizeof(seq->index));
+        for (k = len; k-- > 0; )
+            seq->index[(unsigned char) seq->str[k]] = k;
+        for (k = 0; k < ARRAY_SIZE(seq->index); ++k) {
+            if (seq->index[k] != ZXCVBN_SEQUENCE_NONE)
+                masks[k] |= (uint32_t) 1 << zxcvbn->n_sequences;
+        }
+
+        zxcvbn->sequences[zxcvbn->n_sequences++] = seq;
+    }
+
+    zxcvbn->sequence_masks = masks;
+    return 0;
+
+error:
+    __free(zxcvbn, masks);
+    return -1;
+}
+
+static double
 zxcvbn_sequence_calculate_entropy(struct zxcvbn *zxcvbn,
-                                  struct zxcvbn_match *match,
-                                  char *password, uint32_t password_len)
+                                  const struct zxcvbn_candidates *cands, unsigned int k,
+                                  const char *password)
 {
-    if (strchr(ZXCVBN_SEQUENCE_OBVIOUS_START, password[match->i]))
-        match->entropy = 1;
+    const struct zxcvbn_sequence *seq = cands->aux[k].seq;
+    double entropy;
+
+    if (strchr(ZXCVBN_SEQUENCE_OBVIOUS_START, password[cands->i[k]]))
+        entropy = 1;
     else
-        match->entropy = log2(match->seq->len) + match->seq->extra_entropy;
-    if (match->flags & ZXCVBN_MATCH_DESC_SEQ)
-        match->entropy++;
-    match->entropy += log2(match->j - match->i + 1);
+        entropy = log2(seq->len) + seq->extra_entropy;
+    if (cands->flags[k] & ZXCVBN_MATCH_DESC_SEQ)
+        entropy++;
+    return entropy + log2(cands->j[k] - cands->i[k] + 1);
 }
 
 /* Sequence ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
 
 static int
-match_digits(struct zxcvbn_res *res,
-             const char *password, unsigned int password_len)
+match_digits(struct zxcvbn_res *res, const struct zxcvbn_analysis *analysis,
+             unsigned int password_len)
 {
-    int last = -1, i;
-
-    for (i = 0; i <= password_len; i++) {
-        if (i == password_len || !isdigit(password[i])) {
-            if (i - last - 1 > 2 &&
-                    !push_match(res, ZXCVBN_MATCH_TYPE_DIGITS, NULL,
-                                last + 1, i - 1, 0, 0))
-                return -1;
-            last = i;
-        }
+    unsigned int i, len, run;
+
+    // a run longer than a match is matched in pieces, else skip the non digit
+    for (i = 0; i < password_len; i += len + (len == run)) {
+        run = analysis->digit_runs[i];
+        len = MIN(run, ZXCVBN_MATCH_SPAN_MAX);
+        if (len > 2 &&
+                push_match(res, ZXCVBN_MATCH_TYPE_DIGITS, NULL,
+                           i, i + len - 1, 0, 0) < 0)
+            return -1;
     }
     return 0;
 }
@@ -618,7 +982,7 @@ struct zxcvbn_date_state {
 };
 
 static uint16_t
-zxcvbn_parse_number(char *str, uint8_t len)
+zxcvbn_parse_number(const char *str, uint8_t len)
 {
     uint16_t n = 0;
 
@@ -628,7 +992,7 @@ zxcvbn_parse_number(char *str, uint8_t len)
 }
 
 static inline uint8_t
-zxcvbn_date_probe_year(struct zxcvbn_date *date, char *str)
+zxcvbn_date_probe_year(struct zxcvbn_date *date, const char *str)
 {
     uint16_t year;
 
@@ -644,7 +1008,7 @@ zxcvbn_date_probe_year(struct zxcvbn_date *date, char *str)
 
 static uint8_t
 zxcvbn_date_probe(struct zxcvbn_date *date, uint16_t *nums, uint8_t flags,
-                  struct zxcvbn_date *dates, uint32_t dates_num)
+                  const struct zxcvbn_date *dates, uint32_t dates_num)
 {
     static uint8_t meanings[] = {2, 1, 1, 2, 0, 1, 1, 0};
     struct zxcvbn_date temp, best;
@@ -708,8 +1072,8 @@ zxcvbn_date_probe(struct zxcvbn_date *date, uint16_t *nums, uint8_t flags,
 
 static uint8_t
 zxcvbn_date_probe_split(struct zxcvbn_date *date,
-                        char *str, uint32_t len, uint8_t *split,
-                        struct zxcvbn_date *dates, unsigned int dates_num)
+                        const char *str, uint32_t len, uint8_t *split,
+                        const struct zxcvbn_date *dates, unsigned int dates_num)
 {
     uint8_t len2, flags;
     uint16_t nums[3];
@@ -729,26 +1093,24 @@ zxcvbn_date_probe_split(struct zxcvbn_date *date,
     return zxcvbn_date_probe(date, nums, flags, dates, dates_num);
 }
 
-static struct zxcvbn_match *
+static int
 zxcvbn_date_add_match(struct zxcvbn_res *res, uint32_t i, uint32_t j,
                       struct zxcvbn_date *date)
 {
-    struct zxcvbn_match *match;
+    int k;
 
-    if (!(match = match_add(res)))
-        return NULL;
+    if ((k = candidate_add(res, ZXCVBN_MATCH_TYPE_DATE, i, j, 0)) < 0)
+        return -1;
 
-    match->type = ZXCVBN_MATCH_TYPE_DATE;
-    match->i = i;
-    match->j = j;
-    memcpy(&match->date, date, sizeof(*date));
-    return match;
+    memcpy(&res->candidates.aux[k].date, date, sizeof(*date));
+    return k;
 }
 
 static int8_t
 zxcvbn_date_match_nosep(struct zxcvbn_res *res,
-                        char *password, int password_len,
-                        struct zxcvbn_date *dates, unsigned int dates_num)
+                        const struct zxcvbn_analysis *analysis,
+                        const char *password, int password_len,
+                        const struct zxcvbn_date *dates, unsigned int dates_num)
 {
     static uint8_t split4[][2] = {{1, 2}, {2, 3}, {0, 0}},
                    split5[][2] = {{1, 3}, {2, 3}, {0, 0}},
@@ -764,13 +1126,7 @@ zxcvbn_date_match_nosep(struct zxcvbn_res *res,
 
     i = 0;
     while (i + ZXCVBN_DATE_MIN_NOSEP_LEN - 1 < password_len) {
-        if (!isdigit(password[i])) {
-            i++;
-            continue;
-        }
-        for (j = i + 1; j < password_len && isdigit(password[j]); j++)
-            {;}
-        len = j - i;
+        len = analysis->digit_runs[i];
         if (len < ZXCVBN_DATE_MIN_NOSEP_LEN) {
             i += len + 1;
             continue;
@@ -788,7 +1144,7 @@ zxcvbn_date_match_nosep(struct zxcvbn_res *res,
                             break;
                         }
                     }
-                    if (!zxcvbn_date_add_match(res, k, k + j - 1, &date))
+                    if (zxcvbn_date_add_match(res, k, k + j - 1, &date) < 0)
                         return -1;
                     continue;
                 }
@@ -810,7 +1166,7 @@ zxcvbn_date_match_nosep(struct zxcvbn_res *res,
                     split += 2;
                 }
                 if (best.day) {
-                    if (!zxcvbn_date_add_match(res, k, k + j - 1, &best))
+                    if (zxcvbn_date_add_match(res, k, k + j - 1, &best) < 0)
                         return -1;
                 }
             }
@@ -820,10 +1176,16 @@ zxcvbn_date_match_nosep(struct zxcvbn_res *res,
     return 0;
 }
 
+/*
+ * A date with separators is decided by at most the char after it. If steps
+ * is given, steps[k] is where the step over char k started.
+ */
 static int8_t
 zxcvbn_date_match_sep(struct zxcvbn_res *res,
-                      char *password, int password_len,
-                      struct zxcvbn_date *dates, unsigned int dates_num)
+                      const struct zxcvbn_analysis *analysis,
+                      const char *password, int password_len,
+                      const struct zxcvbn_date *dates, unsigned int dates_num,
+                      uint32_t *steps)
 {
     static struct zxcvbn_date_state states[] = {
         /*          d   s   x       skip  num try p_fl */
@@ -870,15 +1232,16 @@ zxcvbn_date_match_sep(struct zxcvbn_res *res,
     struct zxcvbn_date best, date;
     struct zxcvbn_date_state *state;
     uint16_t n, nums[3];
-    uint32_t i, j, end;
-    uint8_t id, skip;
+    uint32_t i, j, k, end;
+    uint8_t id, skip, class;
     int8_t next;
-    char ch;
 
     i = 0;
     end = 0;
     while (i + ZXCVBN_DATE_MIN_SEP_LEN - 1 < password_len) {
-        if (!isdigit(password[i])) {
+        if (!(analysis->classes[i] & ZXCVBN_CLASS_DIGIT)) {
+            if (steps != NULL)
+                steps[i] = i;
             i++;
             continue;
         }
@@ -888,11 +1251,11 @@ zxcvbn_date_match_sep(struct zxcvbn_res *res,
         n = password[i] - '0';
         for (j = i + 1;; j++) {
             if (j < password_len) {
-                ch = password[j];
-                if (isdigit(ch)) {
+                class = analysis->classes[j];
+                if (class & ZXCVBN_CLASS_DIGIT) {
                     id = 0;
-                    n = n * 10 + ch - '0';
-                } else if (strchr("-._/\\", ch))
+                    n = n * 10 + password[j] - '0';
+                } else if (class & ZXCVBN_CLASS_SEPARATOR)
                     id = 1;
                 else
                     id = 2;
@@ -936,119 +1299,292 @@ zxcvbn_date_match_sep(struct zxcvbn_res *res,
         }
         if (best.day) {
             best.flags |= ZXCVBN_DATE_SEPARATOR;
-            if (!zxcvbn_date_add_match(res, i, end, &best))
+            if (zxcvbn_date_add_match(res, i, end, &best) < 0)
                 return -1;
         }
+        for (k = i; steps != NULL && k < i + skip && k < password_len; ++k)
+            steps[k] = i;
         i += skip;
     }
+    for (k = i; steps != NULL && k < password_len; ++k)
+        steps[k] = i;
     return 0;
 }
 
 static int8_t
-zxcvbn_date_match(struct zxcvbn_res *res, char *password, int password_len,
-                  struct zxcvbn_date *dates, unsigned int dates_num)
+zxcvbn_date_match(struct zxcvbn_res *res,
+                  const struct zxcvbn_analysis *analysis,
+                  const char *password, int password_len,
+                  const struct zxcvbn_date *dates, unsigned int dates_num)
 {
-    if (zxcvbn_date_match_nosep(res, password, password_len, dates, dates_num))
+    if (zxcvbn_date_match_nosep(res, analysis, password, password_len,
+                                dates, dates_num))
         return -1;
-    if (zxcvbn_date_match_sep(res, password, password_len, dates, dates_num))
+    if (zxcvbn_date_match_sep(res, analysis, password, password_len,
+                              dates, dates_num, NULL))
         return -1;
     return 0;
 }
 
-static void
-zxcvbn_date_calculate_entropy(struct zxcvbn *zxcvbn, struct zxcvbn_match *match)
+static double
+zxcvbn_date_calculate_entropy(struct zxcvbn *zxcvbn,
+                              const struct zxcvbn_candidates *cands, unsigned int k)
 {
-    double possib;
+    const struct zxcvbn_date *date = &cands->aux[k].date;
+    double possib, entropy;
 
-    if (match->date.flags & ZXCVBN_DATE_FROM_LIST)
-        match->entropy = 0;
+    if (date->flags & ZXCVBN_DATE_FROM_LIST)
+        entropy = 0;
     else {
-        possib = fmax(abs(match->date.year - ZXCVBN_DATE_REF_YEAR),
+        possib = fmax(abs(date->year - ZXCVBN_DATE_REF_YEAR),
                              ZXCVBN_DATE_MIN_YEAR_SPACE);
-        if (!(match->date.flags & ZXCVBN_DATE_ONLY_YEAR))
+        if (!(date->flags & ZXCVBN_DATE_ONLY_YEAR))
             possib *= 12 * 31;
-        match->entropy = log2(possib);
+        entropy = log2(possib);
     }
-    if (match->date.flags & ZXCVBN_DATE_FULL_YEAR)
-        match->entropy += 1;
-    if (match->date.flags & ZXCVBN_DATE_SEPARATOR)
-        match->entropy += 2;
+    if (date->flags & ZXCVBN_DATE_FULL_YEAR)
+        entropy += 1;
+    if (date->flags & ZXCVBN_DATE_SEPARATOR)
+        entropy += 2;
+    return entropy;
 }
 
 /* Date ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
 
+// matches ending from from on
 static int
-match_dict_iter(struct zxcvbn_res *res, struct zxcvbn_dict *dict, const char *password, unsigned int password_len)
+match_dict_iter(struct zxcvbn_res *res, struct zxcvbn_dict *dict, const char *password,
+                unsigned int from, unsigned int password_len)
 {
-    int i, j;
-    struct zxcvbn_node *node, *parent;
+    int i, j, parent, node;
+    const struct zxcvbn_node *nodes;
+    uint64_t visited;
+
+    nodes = dict->trie.nodes;
+    visited = 0;
 
     for (i = 0; i < password_len; ++i) {
-        parent = dict->root;
+        parent = 0;
         for (j = i; j < password_len; ++j) {
-            if ((node = parent->children[(unsigned char) password[j]]) == NULL)
+            // base ^ c stays in the block of base, so no bounds check here
+            node = nodes[parent].base ^ (unsigned char) password[j];
+            visited++;
+            if (nodes[node].check != parent)
                 break;
-            if (node->rank > 0) {
-                if (push_match_dict(res, i, j, node->rank) == NULL)
+            if (nodes[node].rank > 0 && j >= from) {
+                if (push_match_dict(res, i, j, nodes[node].rank) < 0)
                     return -1;
             }
             parent = node;
         }
     }
 
+    res->stats.trie_nodes += visited;
     return 0;
 }
 
+struct zxcvbn_automaton_hit {
+    int dict;
+    int i, j;
+    int rank;
+};
+
+static int
+automaton_hit_cmp(const void *a, const void *b)
+{
+    const struct zxcvbn_automaton_hit *x = a, *y = b;
+
+    if (x->dict != y->dict)
+        return x->dict - y->dict;
+    if (x->i != y->i)
+        return x->i - y->i;
+    return x->j - y->j;
+}
+
+/*
+ * Single pass over the password for all dictionaries. Hits are sorted in
+ * the order the per dictionary walk of match_dict_iter() pushes them.
+ * With states the pass resumes at from in the state left after from - 1,
+ * and the state after each char is left in states.
+ */
+static int
+match_automaton(struct zxcvbn_res *res, const struct zxcvbn_automaton *automaton,
+                const char *password, unsigned int from, unsigned int password_len,
+                int *states)
+{
+    struct zxcvbn_automaton_hit hit_buf[64], *hits, *hit;
+    unsigned int n_hits, n_hits_reserved;
+    const struct zxcvbn_automaton_out *out;
+    const struct zxcvbn_node *nodes;
+    int j, state, next, ret;
+    uint64_t visited;
+
+    hits = hit_buf;
+    n_hits = 0;
+    n_hits_reserved = ARRAY_SIZE(hit_buf);
+    nodes = automaton->trie.nodes;
+    state = states != NULL && from > 0 ? states[from - 1] : 0;
+    ret = -1;
+    visited = 0;
+
+    for (j = from; j < password_len; ++j) {
+        for (;;) {
+            next = nodes[state].base ^ (unsigned char) password[j];
+            visited++;
+            if (nodes[next].check == state) {
+                state = next;
+                break;
+            }
+            if (state == 0)
+                break;
+            state = automaton->fail[state];
+        }
+        if (states != NULL)
+            states[j] = state;
+
+        for (next = state; next != 0; next = automaton->out_link[next]) {
+            if (nodes[next].rank < 0)
+                continue;
+            for (out = automaton->outs + nodes[next].rank; out->dict >= 0; ++out) {
+                if (n_hits == n_hits_reserved) {
+                    n_hits_reserved *= 2;
+                    if (hits == hit_buf) {
+                        if ((hits = __malloc(res->zxcvbn, n_hits_reserved * sizeof(*hits))) == NULL)
+                            return -1;
+                        memcpy(hits, hit_buf, sizeof(hit_buf));
+                    } else {
+                        if ((hit = __realloc(res->zxcvbn, hits, n_hits_reserved * sizeof(*hits))) == NULL)
+                            goto out;
+                        hits = hit;
+                    }
+                }
+                hit = hits + n_hits++;
+                hit->dict = out->dict;
+                hit->i = j - automaton->depth[next] + 1;
+                hit->j = j;
+                hit->rank = out->rank;
+            }
+        }
+    }
+
+    res->stats.trie_nodes += visited;
+    qsort(hits, n_hits, sizeof(*hits), automaton_hit_cmp);
+
+    for (hit = hits; hit < hits + n_hits; ++hit) {
+        if (push_match_dict(res, hit->i, hit->j, hit->rank) < 0)
+            goto out;
+    }
+    ret = 0;
+
+out:
+    if (hits != hit_buf)
+        __free(res->zxcvbn, hits);
+    return ret;
+}
+
 static char *
 pack_word(struct zxcvbn *zxcvbn, char *dst, const char *src, unsigned int len)
 {
     int i;
 
     for (i = 0; i < len; ++i)
-        dst[i] = zxcvbn->pack_table[(unsigned char) tolower(src[i])];
+        dst[i] = pack_char(zxcvbn, src[i]);
 
     return dst;
 }
 
+// occurrences of a user word starting from from on that don't overlap it
 static int
-match_dict(struct zxcvbn_res *res, const char *password, unsigned int password_len,
-           char **dict_words, unsigned int n_dict_words)
+match_word(struct zxcvbn_res *res, const char *pack_password, unsigned int from,
+           unsigned int password_len, const char *dict_word, unsigned int dict_word_len)
 {
-    int i, dict_word_len, remain;
-    char pack_password[ZXCVBN_PASSWORD_LEN_MAX], *pack_dict_word, *s;
-    struct zxcvbn_dict *dict;
-    struct zxcvbn *zxcvbn;
+    char word_buf[ZXCVBN_STACK_LEN], *pack_dict_word;
+    const char *s;
+    int remain, ret;
 
-    zxcvbn = res->zxcvbn;
+    pack_dict_word = word_buf;
+    if (dict_word_len > sizeof(word_buf) &&
+            (pack_dict_word = __malloc(res->zxcvbn, dict_word_len)) == NULL)
+        return -1;
+    pack_word(res->zxcvbn, pack_dict_word, dict_word, dict_word_len);
+    s = pack_password + from;
+    ret = 0;
+    while (1) {
+        if ((remain = password_len - (s - pack_password)) <= 0 ||
+                !(s = memmem(s, remain, pack_dict_word, dict_word_len)))
+            break;
+        if (push_match_dict(res, s - pack_password,
+                            s - pack_password + dict_word_len - 1, 1) < 0) {
+            ret = -1;
+            break;
+        }
+        s += dict_word_len;
+    }
+    if (pack_dict_word != word_buf)
+        __free(res->zxcvbn, pack_dict_word);
+
+    return ret;
+}
 
-    pack_word(zxcvbn, pack_password, password, password_len);
+// user words, every word is matched where it doesn't overlap itself
+static int
+match_words(struct zxcvbn_res *res, const char *pack_password, unsigned int password_len,
+            const char *const *dict_words, unsigned int n_dict_words)
+{
+    int i, dict_word_len;
 
     for (i = 0; i < n_dict_words; ++i) {
         dict_word_len = strlen(dict_words[i]);
         if (!dict_word_len || password_len < dict_word_len)
             continue;
-        pack_dict_word = pack_word(zxcvbn, dict_words[i],
-                                   dict_words[i], dict_word_len);
-        s = pack_password;
-        while (1) {
-            if ((remain = password_len - (s - pack_password)) <= 0 ||
-                    !(s = memmem(s, remain, pack_dict_word, dict_word_len)))
-                break;
-            if (!push_match_dict(res, s - pack_password,
-                                 s - pack_password + dict_word_len - 1, 1))
-                return -1;
-            s += dict_word_len;
-        }
+        if (match_word(res, pack_password, 0, password_len,
+                       dict_words[i], dict_word_len) < 0)
+            return -1;
     }
 
+    return 0;
+}
+
+/*
+ * Matches of the dictionary set and the dictionaries ending from from on,
+ * resuming automatons from set_states and states if given.
+ */
+static int
+match_dicts(struct zxcvbn_res *res, const struct zxcvbn_dict_set *set,
+            const char *pack_password, unsigned int from, unsigned int password_len,
+            int *set_states, int *states)
+{
+    struct zxcvbn_dict *dict;
+    struct zxcvbn *zxcvbn;
+
+    zxcvbn = res->zxcvbn;
+
+    if (set != NULL && match_automaton(res, &set->automaton, pack_password,
+                                       from, password_len, set_states) < 0)
+        return -1;
+
+    if (zxcvbn->automaton)
+        return match_automaton(res, zxcvbn->automaton, pack_password,
+                               from, password_len, states);
+
     LIST_FOREACH(dict, &res->zxcvbn->dict_head, list) {
-        if (match_dict_iter(res, dict, pack_password, password_len) < 0)
+        if (match_dict_iter(res, dict, pack_password, from, password_len) < 0)
             return -1;
     }
 
     return 0;
 }
 
+static int
+match_dict(struct zxcvbn_res *res, const struct zxcvbn_dict_set *set,
+           const struct zxcvbn_analysis *analysis, unsigned int password_len,
+           const char *const *dict_words, unsigned int n_dict_words)
+{
+    if (match_words(res, analysis->pack, password_len, dict_words, n_dict_words) < 0)
+        return -1;
+    return match_dicts(res, set, analysis->pack, 0, password_len, NULL, NULL);
+}
+
 static unsigned int
 nCk(unsigned int n, unsigned int k)
 {
@@ -1070,472 +1606,3986 @@ nCk(unsigned int n, unsigned int k)
     return r;
 }
 
-static void
-entropy_dict(struct zxcvbn *zxcvbn, struct zxcvbn_match *match, const char *password, unsigned int password_len)
+// log2 of the number of ways to flip case of at most k of n letters
+static double
+case_entropy(struct zxcvbn *zxcvbn, unsigned int n, unsigned int k)
 {
-    int i, ch, upper, lower, min_lower_upper;
     double possibilities;
+    unsigned int i;
 
-    match->entropy = log2(match->rank);
+    if (n < ZXCVBN_ENTROPY_TABLE_LEN)
+        return case_entropy_table[n][k];
 
-    upper = 0;
-    lower = 0;
+    possibilities = 0;
+    for (i = 0; i <= k; ++i)
+        possibilities += nCk(n, i);
+    return log2(possibilities);
+}
 
-    for (i = match->i; i <= match->j; ++i) {
-        ch = password[i];
-        if (isalpha(ch)) {
-            if (isupper(ch))
-                ++upper;
-            else if (islower(ch))
-                ++lower;
-        }
-    }
+static inline double
+rank_entropy(unsigned int rank)
+{
+    if (rank < ZXCVBN_RANK_TABLE_SIZE)
+        return rank_entropy_table[rank];
+    else
+        return log2(rank);
+}
 
-    if (upper == 1 && isupper(password[match->i]))
-        match->entropy += 1;
-    else if (upper) {
-        min_lower_upper = MIN(lower, upper);
-        possibilities = 0;
-        for (i = 0; i <= min_lower_upper; ++i)
-            possibilities += nCk(upper + lower, i);
-        match->entropy += log2(possibilities);
-    }
+static double
+entropy_dict(struct zxcvbn *zxcvbn, const struct zxcvbn_candidates *cands,
+             unsigned int k, const struct zxcvbn_analysis *analysis)
+{
+    unsigned int rank = cands->aux[k].rank, i = cands->i[k], j = cands->j[k];
+    int upper, lower;
+    double entropy;
+
+    entropy = rank_entropy(rank);
+
+    upper = ANALYSIS_COUNT(analysis, uppers, i, j);
+    lower = ANALYSIS_COUNT(analysis, lowers, i, j);
+
+    if (upper == 1 && (analysis->classes[i] & ZXCVBN_CLASS_UPPER))
+        entropy += 1;
+    else if (upper)
+        entropy += case_entropy(zxcvbn, upper + lower, MIN(lower, upper));
+    return entropy;
 }
 
-static void
-entropy_spatial(struct zxcvbn *zxcvbn, struct zxcvbn_match *match)
+/*
+ * Possibilities of spatial patterns up to length with up to turns turns,
+ * sums are accumulated in the same order for tables and long matches.
+ */
+static double
+spatial_possibilities(const struct zxcvbn_spatial_graph *spatial_graph,
+                      double possibilities, unsigned int length, unsigned int turns)
 {
-    unsigned int i, j;
-    unsigned int length, turns, possible_turns, S, U, min_SU;
-    double possibilities;
-    struct zxcvbn_spatial_graph *spatial_graph;
+    unsigned int j, possible_turns;
 
-    spatial_graph = match->spatial_graph;
+    possible_turns = MIN(turns, length - 1);
+    for (j = 1; j <= possible_turns; ++j)
+        possibilities += nCk(length - 1, j - 1) * spatial_graph->n_chars * pow(spatial_graph->degree, j);
 
-    length = match->j - match->i + 1;
-    turns = match->turns;
-    possibilities = 0;
+    return possibilities;
+}
+
+/*
+ * log2 of the possibilities of entropy_spatial() summed in the log domain,
+ * for walks long enough to overflow them
+ */
+static double
+spatial_entropy_log(const struct zxcvbn_spatial_graph *spatial_graph,
+                    unsigned int length, unsigned int turns)
+{
+    unsigned int i, j, ways;
+    double term, entropy = -INFINITY;
 
     for (i = 2; i <= length; ++i) {
-        possible_turns = MIN(turns, i - 1);
-        for (j = 1; j <= possible_turns; ++j) {
-            possibilities += nCk(i - 1, j - 1) * spatial_graph->n_chars * pow(spatial_graph->degree, j);
+        for (j = 1; j <= MIN(turns, i - 1); ++j) {
+            if ((ways = nCk(i - 1, j - 1) * spatial_graph->n_chars) == 0)
+                continue;
+            term = log2(ways) + j * log2(spatial_graph->degree);
+            entropy = MAX(entropy, term) + log2(1 + exp2(-fabs(entropy - term)));
         }
     }
 
-    match->entropy = log2(possibilities);
+    return entropy;
+}
 
-    if (match->shifted) {
-        S = match->shifted;
-        U = length - S;
-        min_SU = MIN(S, U);
+static double
+entropy_spatial(struct zxcvbn *zxcvbn, const struct zxcvbn_candidates *cands,
+                unsigned int k, const struct zxcvbn_analysis *analysis)
+{
+    unsigned int i, length, turns, S, U;
+    double possibilities, entropy;
+    const struct zxcvbn_spatial_graph *spatial_graph;
+
+    spatial_graph = cands->aux[k].spatial.graph;
+
+    length = cands->j[k] - cands->i[k] + 1;
+    if (spatial_graph->n_wide_keys > 0)
+        length = ANALYSIS_COUNT(analysis, utf8_chars, cands->i[k], cands->j[k]);
+    turns = cands->aux[k].spatial.turns;
+
+    if (length < ZXCVBN_ENTROPY_TABLE_LEN)
+        entropy = spatial_graph->entropy[length][MIN(turns, length - 1)];
+    else {
         possibilities = 0;
-        for (i = 0; i <= min_SU; ++i)
-            possibilities += nCk(S + U, i);
-        match->entropy += log2(possibilities);
+        for (i = 2; i <= length; ++i)
+            possibilities = spatial_possibilities(spatial_graph, possibilities, i, turns);
+        entropy = log2(possibilities);
+        // pow() overflows on walks of a raised ZXCVBN_MATCH_SPAN_MAX
+        if (isinf(entropy))
+            entropy = spatial_entropy_log(spatial_graph, length, turns);
+    }
+
+    if (cands->aux[k].spatial.shifted) {
+        S = cands->aux[k].spatial.shifted;
+        U = length - S;
+        entropy += case_entropy(zxcvbn, S + U, MIN(S, U));
     }
+    return entropy;
 }
 
-static void
-entropy_digits(struct zxcvbn *zxcvbn, struct zxcvbn_match *match)
+static double
+entropy_digits(struct zxcvbn *zxcvbn, const struct zxcvbn_candidates *cands,
+               unsigned int k)
 {
-    match->entropy = log2(pow(10, match->j - match->i + 1));
+    unsigned int length;
+    double entropy;
+
+    length = cands->j[k] - cands->i[k] + 1;
+    if (length < ZXCVBN_ENTROPY_TABLE_LEN)
+        return digits_entropy_table[length];
+
+    entropy = log2(pow(10, length));
+    // pow() overflows on runs of a raised ZXCVBN_MATCH_SPAN_MAX
+    if (isinf(entropy))
+        entropy = length * log2(10);
+    return entropy;
 }
 
-struct zxcvbn *
-zxcvbn_init_ex(struct zxcvbn *zxcvbn, struct zxcvbn_opts *opts)
-{
-    static struct zxcvbn_opts default_opts;
-    zxcvbn_malloc_t malloc_;
-    int i, l33t;
-    const unsigned char *s;
+/* Cache ==================================================================== */
 
-    if (!opts)
-        opts = &default_opts;
-    malloc_ = (opts->malloc ? opts->malloc : malloc);
+// longer passwords and paths are matched every time
+#define CACHE_PASSWORD_LEN  32
+#define CACHE_PATH_LEN      8
 
-    if (zxcvbn)
-        memset(zxcvbn, 0, sizeof(*zxcvbn));
-    else {
-        if (!(zxcvbn = malloc_(sizeof(*zxcvbn))))
-            return NULL;
-        memset(zxcvbn, 0, sizeof(*zxcvbn));
-        zxcvbn->allocated = 1;
-    }
+struct cache_match {
+    union zxcvbn_candidate_aux  aux;
+    double                      entropy;
+    uint16_t                    i;
+    uint16_t                    j;
+    uint8_t                     type;
+    uint8_t                     flags;
+};
 
-    zxcvbn->zxcvbn_malloc = malloc_;
-    if (opts->malloc) {
-        assert(opts->realloc);
-        assert(opts->free);
+struct cache_entry {
+    uint8_t             password_len;
+    uint8_t             n_path;
+    unsigned long       generation;
+    /* of words and dates */
+    uint64_t            hash;
+    double              entropy;
+    char                password[CACHE_PASSWORD_LEN];
+    struct cache_match  path[CACHE_PATH_LEN];
+};
 
-        zxcvbn->zxcvbn_realloc = opts->realloc;
-        zxcvbn->zxcvbn_free = opts->free;
-    } else {
-        assert(!opts->realloc);
-        assert(!opts->free);
+#define CACHE_ENTRY_WORDS   ((sizeof(struct cache_entry) + sizeof(unsigned long) - 1) / \
+                             sizeof(unsigned long))
+
+/*
+ * A slot is a seqlock, seq is odd while the slot is written. The entry is
+ * copied in and out a word at a time with relaxed atomics. A reader takes a
+ * copy torn by a writer as a miss, a writer finding the slot busy doesn't
+ * store its result.
+ */
+struct zxcvbn_cache_slot {
+    unsigned int        seq;
+    union {
+        struct cache_entry  entry;
+        unsigned long       words[CACHE_ENTRY_WORDS];
+    };
+};
 
-        zxcvbn->zxcvbn_realloc = realloc;
-        zxcvbn->zxcvbn_free = free;
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+
+static inline uint64_t
+fnv_hash(uint64_t h, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    while (len-- > 0)
+        h = (h ^ *p++) * FNV_PRIME;
+    return h;
+}
+
+// FNV mixes the last bytes into low bits poorly
+static inline uint64_t
+hash_mix(uint64_t h)
+{
+    h ^= h >> 31;
+    h *= 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+static uint64_t
+cache_hash(const char *const *words,        unsigned int words_num,
+           const struct zxcvbn_date *dates, unsigned int dates_num)
+{
+    uint64_t h = FNV_OFFSET;
+    unsigned int i;
+    uint8_t date[5];
+
+    // a word ends with a zero so that "ab", "c" differs from "a", "bc"
+    for (i = 0; i < words_num; ++i)
+        h = fnv_hash(h, words[i], strlen(words[i]) + 1);
+    h = fnv_hash(h, &words_num, sizeof(words_num));
+
+    for (i = 0; i < dates_num; ++i) {
+        date[0] = dates[i].day;
+        date[1] = dates[i].month;
+        date[2] = dates[i].year & 0xff;
+        date[3] = dates[i].year >> 8;
+        date[4] = dates[i].flags;
+        h = fnv_hash(h, date, sizeof(date));
     }
+    return h;
+}
 
-    zxcvbn->max_matches_num = opts->max_matches_num;
-    zxcvbn->skipped_match_types = opts->skipped_match_types;
+static struct zxcvbn_cache_slot *
+cache_slot(struct zxcvbn *zxcvbn, const char *password, unsigned int password_len,
+           uint64_t hash)
+{
+    hash = hash_mix(fnv_hash(hash, password, password_len));
+    return zxcvbn->cache + (hash & zxcvbn->cache_mask);
+}
 
-    LIST_INIT(&zxcvbn->dict_head);
+static int
+cache_init(struct zxcvbn *zxcvbn, unsigned int size)
+{
+    unsigned int n;
 
-    memset(zxcvbn->pack_table, '.', sizeof(zxcvbn->pack_table));
+    for (n = 1; n < size; n *= 2)
+        ;
+    zxcvbn->cache = __malloc(zxcvbn, sizeof(*zxcvbn->cache) * n);
+    if (zxcvbn->cache == NULL)
+        return -1;
+    memset(zxcvbn->cache, 0, sizeof(*zxcvbn->cache) * n);
+    zxcvbn->cache_mask = n - 1;
 
-    for (i = 'a'; i <= 'z'; ++i)
-        zxcvbn->pack_table[i] = zxcvbn->pack_table_size++;
+    return 0;
+}
 
-    for (i = '0'; i <= '9'; ++i)
-        zxcvbn->pack_table[i] = zxcvbn->pack_table_size++;
+// slots stored before are never found again
+static inline void
+cache_invalidate(struct zxcvbn *zxcvbn)
+{
+    __atomic_fetch_add(&zxcvbn->cache_generation, 1, __ATOMIC_SEQ_CST);
+}
 
-    for (s = (void *) opts->symbols; *s != '\0'; ++s) {
-        if (zxcvbn->pack_table[*s] == '.') {
-            zxcvbn->pack_table[*s] = zxcvbn->pack_table_size++;
-            zxcvbn->n_symbols++;
-        }
-    }
+// fill res with the path of a slot, 1 on a hit
+static int
+cache_lookup(struct zxcvbn_res *res, struct zxcvbn_cache_slot *slot,
+             unsigned long generation, uint64_t hash,
+             const char *password, unsigned int password_len)
+{
+    struct zxcvbn *zxcvbn = res->zxcvbn;
+    struct zxcvbn_cache_slot copy;
+    struct zxcvbn_match *match;
+    const struct cache_match *m;
+    unsigned int seq, i;
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+        goto miss;
+    for (i = 0; i < CACHE_ENTRY_WORDS; ++i)
+        copy.words[i] = __atomic_load_n(slot->words + i, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+        goto miss;
+
+    if (copy.entry.generation != generation || copy.entry.hash != hash ||
+            copy.entry.password_len != password_len ||
+            memcmp(copy.entry.password, password, password_len) != 0)
+        goto miss;
+
+    res->candidates.n = 0;
+    res->n_matches = 0;
+    for (i = 0; i < copy.entry.n_path; ++i) {
+        if ((match = match_add(res)) == NULL)
+            return -1;
+        m = copy.entry.path + i;
+        match->type = m->type;
+        match->i = m->i;
+        match->j = m->j;
+        match->flags = m->flags;
+        match->entropy = m->entropy;
+        match->spatial_graph = NULL;
+        match->turns = 0;
+        match->shifted = 0;
+        match->rank = 0;
 
-    // l33t
-    for (i = 0; i < 256; ++i) { 
-        switch (i) {
-        case '4':
-        case '@':
-            l33t = 'a';
-            break;
-        case '8':
-            l33t = 'b';
-            break;
-        case '(':
-        case '{':
-        case '[':
-        case '<':
-            l33t = 'c';
-            break;
-        case '3':
-            l33t = 'e';
-            break;
-        case '6':
-        case '9':
-            l33t = 'g';
-            break;
-        case '1':
-        case '!':
-        case '|':
-            l33t = 'i';
-            break;
-        case '0':
-            l33t = 'o';
-            break;
-        case '$':
-        case '5':
-            l33t = 's';
+        switch (match->type) {
+        case ZXCVBN_MATCH_TYPE_DICT:
+        case ZXCVBN_MATCH_TYPE_BREACH:
+            match->rank = m->aux.rank;
             break;
-        case '+':
-        case '7':
-            l33t = 't';
+        case ZXCVBN_MATCH_TYPE_SPATIAL:
+            match->spatial_graph = m->aux.spatial.graph;
+            match->turns = m->aux.spatial.turns;
+            match->shifted = m->aux.spatial.shifted;
             break;
-        case '%':
-            l33t = 'x';
+        case ZXCVBN_MATCH_TYPE_SEQUENCE:
+            match->seq = m->aux.seq;
             break;
-        case '2':
-            l33t = 'z';
+        case ZXCVBN_MATCH_TYPE_DATE:
+            match->date = m->aux.date;
             break;
         default:
-            continue;
+            break;
         }
-        zxcvbn->pack_table[i] = zxcvbn->pack_table[l33t];
     }
-    make_spatial_graph(zxcvbn);
 
-    return zxcvbn;
-}
+    CIRCLEQ_INIT(&res->match_head);
+    for (i = 0; i < res->n_matches; i++)
+        CIRCLEQ_INSERT_TAIL(&res->match_head, res->matches + i, list);
+    res->entropy = copy.entry.entropy;
 
-struct zxcvbn *
-zxcvbn_init(struct zxcvbn *zxcvbn_buf,
-            void *(*zxcvbn_malloc)(size_t size),
-            void *(*zxcvbn_realloc)(void *ptr, size_t size),
-            void (*zxcvbn_free)(void *ptr),
-            const char *symbols)
-{
-    struct zxcvbn_opts opts;
+    __atomic_fetch_add(&zxcvbn->cache_hits, 1, __ATOMIC_RELAXED);
+    res->stats.cache_hits++;
+    return 1;
 
-    zxcvbn_opts_init(&opts);
-    opts.malloc = zxcvbn_malloc;
-    opts.realloc = zxcvbn_realloc;
-    opts.free = zxcvbn_free;
-    opts.symbols = symbols;
-    return zxcvbn_init_ex(zxcvbn_buf, &opts);
+miss:
+    __atomic_fetch_add(&zxcvbn->cache_misses, 1, __ATOMIC_RELAXED);
+    res->stats.cache_misses++;
+    return 0;
 }
 
-static int
-min_entropy(struct zxcvbn_res *res, const char *password, unsigned int password_len)
+static void
+cache_store(const struct zxcvbn_res *res, struct zxcvbn_cache_slot *slot,
+            unsigned long generation, uint64_t hash,
+            const char *password, unsigned int password_len)
 {
-    int i, end, pos, match_i, matches[ZXCVBN_PASSWORD_LEN_MAX];
-    int min_matches[ZXCVBN_PASSWORD_LEN_MAX], min_matches_num;
-    double pos_entropy[ZXCVBN_PASSWORD_LEN_MAX], entropy;
-    unsigned int bruteforce_card;
-    struct zxcvbn_match *match;
+    const struct zxcvbn_match *match;
+    struct zxcvbn_cache_slot copy;
+    struct cache_match *m;
+    unsigned int seq, i;
 
-    assert(password_len > 0);
-    assert(password_len <= ZXCVBN_PASSWORD_LEN_MAX);
-
-    bruteforce_card = calc_bruteforce_card(password, password_len, res->zxcvbn->n_symbols);
-    pos_entropy[0] = 0;
-
-    for (pos = 0; pos < password_len; ++pos) {
-        pos_entropy[pos] = pos > 0 ? pos_entropy[pos - 1] : 0;
-        pos_entropy[pos] += log2(bruteforce_card);
-        matches[pos] = -1;
+    if (res->n_matches > CACHE_PATH_LEN)
+        return;
 
-        for (match_i = 0; match_i < res->n_matches; ++match_i) {
-            match = res->matches + match_i;
-            if (match->j != pos)
-                continue;
+    memset(&copy, 0, sizeof(copy));
+    copy.entry.generation = generation;
+    copy.entry.hash = hash;
+    copy.entry.entropy = res->entropy;
+    copy.entry.password_len = password_len;
+    memcpy(copy.entry.password, password, password_len);
+    copy.entry.n_path = res->n_matches;
 
-            entropy = match->i > 0 ? pos_entropy[match->i - 1] : 0;
-            entropy += match->entropy;
+    for (i = 0; i < res->n_matches; ++i) {
+        match = res->matches + i;
+        m = copy.entry.path + i;
+        m->type = match->type;
+        m->i = match->i;
+        m->j = match->j;
+        m->flags = match->flags;
+        m->entropy = match->entropy;
 
-            if (pos_entropy[pos] > entropy) {
-                pos_entropy[pos] = entropy;
-                matches[pos] = match_i;
+        switch (match->type) {
+        case ZXCVBN_MATCH_TYPE_DICT:
+        case ZXCVBN_MATCH_TYPE_BREACH:
+            m->aux.rank = match->rank;
+            break;
+        case ZXCVBN_MATCH_TYPE_SPATIAL:
+            m->aux.spatial.graph = match->spatial_graph;
+            m->aux.spatial.turns = match->turns;
+            m->aux.spatial.shifted = match->shifted;
+            break;
+        case ZXCVBN_MATCH_TYPE_SEQUENCE:
+            m->aux.seq = match->seq;
+            break;
+        case ZXCVBN_MATCH_TYPE_DATE:
+            m->aux.date = match->date;
+            break;
+        default:
+            break;
+        }
+    }
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) || !__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, 0,
+                                                  __ATOMIC_ACQUIRE,
+                                                  __ATOMIC_RELAXED))
+        return;
+    // the odd seq is seen before any word of the entry
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (i = 0; i < CACHE_ENTRY_WORDS; ++i)
+        __atomic_store_n(slot->words + i, copy.words[i], __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void
+zxcvbn_cache_stats(struct zxcvbn *zxcvbn, unsigned long *hits, unsigned long *misses)
+{
+    *hits = __atomic_load_n(&zxcvbn->cache_hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&zxcvbn->cache_misses, __ATOMIC_RELAXED);
+}
+
+void
+zxcvbn_cache_clear(struct zxcvbn *zxcvbn)
+{
+    cache_invalidate(zxcvbn);
+}
+
+/* Cache ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Breach corpus ============================================================ */
+
+#define ZXCVBN_BREACH_IMAGE_MAGIC   "ZXCVBNB"
+#define ZXCVBN_BREACH_IMAGE_VERSION 1
+#define ZXCVBN_BREACH_IMAGE_ORDER   0x01020304
+#define ZXCVBN_BREACH_SEEDS_MAX     64
+
+/*
+ * The image is the header followed by the hashes of the passwords in
+ * ascending order, their ranks and the fingerprints of an xor filter over the
+ * hashes. The filter rejects almost all passwords out of the corpus in three
+ * reads, the others are searched in the hashes, which are uniform, by
+ * interpolation. Integers are in the byte order of the host that saved it.
+ */
+struct zxcvbn_breach_image {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t seed;
+    uint32_t n_entries;
+    /* the filter has three blocks of block_len fingerprints */
+    uint32_t block_len;
+};
+
+struct breach_entry {
+    uint64_t hash;
+    uint32_t rank;
+};
+
+struct zxcvbn_breach {
+    struct zxcvbn *zxcvbn;
+    /* added by zxcvbn_breach_add() */
+    struct breach_entry *entries;
+    size_t n_entries;
+    size_t n_entries_reserved;
+    /* image mapped by zxcvbn_breach_load_mmap(), read-only */
+    void *map;
+    size_t map_size;
+    const struct zxcvbn_breach_image *image;
+    const uint64_t *hashes;
+    const uint32_t *ranks;
+    const uint8_t *fingerprints;
+};
+
+static inline uint64_t
+breach_hash(const char *password, unsigned int password_len)
+{
+    return hash_mix(fnv_hash(FNV_OFFSET, password, password_len));
+}
+
+// slots of hash in the three blocks of the filter
+static inline void
+breach_slots(uint64_t hash, uint64_t seed, uint32_t block_len, uint32_t slots[3],
+             uint8_t *fingerprint)
+{
+    uint64_t h = hash_mix(hash + seed);
+
+    slots[0] = ((uint64_t) (uint32_t) h * block_len) >> 32;
+    slots[1] = (((uint64_t) (uint32_t) (h >> 21 | h << 43) * block_len) >> 32) + block_len;
+    slots[2] = (((uint64_t) (uint32_t) (h >> 42 | h << 22) * block_len) >> 32) + 2 * block_len;
+    *fingerprint = h ^ (h >> 32);
+}
+
+// rank of the password with hash or 0
+static unsigned int
+breach_lookup(const struct zxcvbn_breach *breach, uint64_t hash)
+{
+    const struct zxcvbn_breach_image *image = breach->image;
+    const uint64_t *hashes = breach->hashes;
+    size_t lo, hi, pos;
+    uint32_t slots[3];
+    uint8_t fingerprint;
+
+    if (image->n_entries == 0)
+        return 0;
+
+    breach_slots(hash, image->seed, image->block_len, slots, &fingerprint);
+    if (fingerprint != (breach->fingerprints[slots[0]] ^
+                        breach->fingerprints[slots[1]] ^
+                        breach->fingerprints[slots[2]]))
+        return 0;
+
+    lo = 0;
+    hi = image->n_entries - 1;
+    while (lo <= hi && hash >= hashes[lo] && hash <= hashes[hi]) {
+        if (hashes[hi] == hashes[lo])
+            pos = lo;
+        else
+            pos = lo + (double) (hash - hashes[lo]) /
+                       (double) (hashes[hi] - hashes[lo]) * (hi - lo);
+        pos = MIN(MAX(pos, lo), hi);
+
+        if (hashes[pos] == hash)
+            return breach->ranks[pos];
+        if (hashes[pos] < hash)
+            lo = pos + 1;
+        else if (pos == 0)
+            break;
+        else
+            hi = pos - 1;
+    }
+    return 0;
+}
+
+// the whole password if the corpus has its hash
+static int
+match_breach_hash(struct zxcvbn_res *res, uint64_t hash, unsigned int password_len)
+{
+    const struct zxcvbn_breach *breach = res->zxcvbn->breach;
+    unsigned int rank;
+    int k;
+
+    if (breach == NULL)
+        return 0;
+
+    if ((rank = breach_lookup(breach, hash)) == 0)
+        return 0;
+
+    if ((k = candidate_add(res, ZXCVBN_MATCH_TYPE_BREACH, 0, password_len - 1, 0)) < 0)
+        return -1;
+    res->candidates.aux[k].rank = rank;
+
+    return 0;
+}
+
+static int
+match_breach(struct zxcvbn_res *res, const char *password, unsigned int password_len)
+{
+    if (res->zxcvbn->breach == NULL)
+        return 0;
+    return match_breach_hash(res, breach_hash(password, password_len), password_len);
+}
+
+struct zxcvbn_breach *
+zxcvbn_breach_init(struct zxcvbn *zxcvbn)
+{
+    struct zxcvbn_breach *breach;
+
+    if ((breach = __malloc(zxcvbn, sizeof(*breach))) == NULL)
+        return NULL;
+    memset(breach, 0, sizeof(*breach));
+    breach->zxcvbn = zxcvbn;
+
+    return breach;
+}
+
+int
+zxcvbn_breach_add(struct zxcvbn_breach *breach,
+                  const char *password, unsigned int password_len, unsigned int rank)
+{
+    struct breach_entry *entries;
+    size_t n_reserved;
+
+    if (breach->map != NULL || rank == 0)
+        return -1;
+
+    if (breach->n_entries == breach->n_entries_reserved) {
+        n_reserved = MAX(breach->n_entries_reserved * 2, 1024);
+        if (n_reserved > UINT32_MAX)
+            return -1;
+        entries = __realloc(breach->zxcvbn, breach->entries, sizeof(*entries) * n_reserved);
+        if (entries == NULL)
+            return -1;
+        breach->entries = entries;
+        breach->n_entries_reserved = n_reserved;
+    }
+
+    breach->entries[breach->n_entries].hash = breach_hash(password, password_len);
+    breach->entries[breach->n_entries].rank = rank;
+    breach->n_entries++;
+
+    return 0;
+}
+
+static int
+breach_entry_cmp(const void *a, const void *b)
+{
+    const struct breach_entry *x = a, *y = b;
+
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    return x->rank < y->rank ? -1 : x->rank > y->rank;
+}
+
+/*
+ * Fill an xor filter of the hashes: peel the slots having a single hash, the
+ * fingerprint of a hash goes to its slot peeled last. Fails, rarely, when the
+ * slots don't peel, then a different seed is tried.
+ */
+static int
+breach_filter(struct zxcvbn_breach *breach, uint64_t seed, uint32_t block_len,
+              uint8_t *fingerprints, uint64_t *xors, uint32_t *counts,
+              uint32_t *queue, uint32_t *stack)
+{
+    size_t n_slots = 3 * (size_t) block_len, n_queue, n_stack, k;
+    uint32_t slots[3], slot, s;
+    uint8_t fingerprint;
+    uint64_t hash;
+
+    memset(xors, 0, sizeof(*xors) * n_slots);
+    memset(counts, 0, sizeof(*counts) * n_slots);
+    for (k = 0; k < breach->n_entries; ++k) {
+        breach_slots(breach->entries[k].hash, seed, block_len, slots, &fingerprint);
+        for (s = 0; s < 3; ++s) {
+            xors[slots[s]] ^= breach->entries[k].hash;
+            counts[slots[s]]++;
+        }
+    }
+
+    for (n_queue = 0, slot = 0; slot < n_slots; ++slot) {
+        if (counts[slot] == 1)
+            queue[n_queue++] = slot;
+    }
+
+    // stack has the peeled slots, the hash of a slot is left in xors
+    n_stack = 0;
+    while (n_queue > 0) {
+        slot = queue[--n_queue];
+        if (counts[slot] != 1)
+            continue;
+        hash = xors[slot];
+        stack[n_stack++] = slot;
+        breach_slots(hash, seed, block_len, slots, &fingerprint);
+        for (s = 0; s < 3; ++s) {
+            if (slots[s] == slot) {
+                counts[slot] = 0;
+                continue;
+            }
+            xors[slots[s]] ^= hash;
+            if (--counts[slots[s]] == 1)
+                queue[n_queue++] = slots[s];
+        }
+    }
+    if (n_stack != breach->n_entries)
+        return -1;
+
+    memset(fingerprints, 0, n_slots);
+    while (n_stack > 0) {
+        slot = stack[--n_stack];
+        breach_slots(xors[slot], seed, block_len, slots, &fingerprint);
+        fingerprints[slot] = fingerprint ^ fingerprints[slots[0]] ^
+                             fingerprints[slots[1]] ^ fingerprints[slots[2]];
+    }
+    return 0;
+}
+
+int
+zxcvbn_breach_save(struct zxcvbn_breach *breach, const char *path)
+{
+    struct zxcvbn *zxcvbn = breach->zxcvbn;
+    struct zxcvbn_breach_image image;
+    uint8_t *fingerprints = NULL;
+    uint64_t *xors = NULL;
+    uint32_t *counts = NULL, *queue = NULL, *stack = NULL;
+    char tmp_path[PATH_MAX];
+    size_t n_slots, k, n;
+    unsigned int i;
+    FILE *file = NULL;
+    int ret = -1;
+
+    if (breach->map != NULL)
+        return -1;
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path))
+        return -1;
+
+    // the most common of equal hashes is kept
+    if (breach->n_entries > 0)
+        qsort(breach->entries, breach->n_entries, sizeof(*breach->entries), breach_entry_cmp);
+    for (k = 0, n = 0; k < breach->n_entries; ++k) {
+        if (n == 0 || breach->entries[k].hash != breach->entries[n - 1].hash)
+            breach->entries[n++] = breach->entries[k];
+    }
+    breach->n_entries = n;
+
+    memset(&image, 0, sizeof(image));
+    memcpy(image.magic, ZXCVBN_BREACH_IMAGE_MAGIC, sizeof(ZXCVBN_BREACH_IMAGE_MAGIC));
+    image.version = ZXCVBN_BREACH_IMAGE_VERSION;
+    image.byte_order = ZXCVBN_BREACH_IMAGE_ORDER;
+    image.n_entries = n;
+    image.block_len = (32 + 1.23 * n) / 3 + 1;
+    n_slots = 3 * (size_t) image.block_len;
+
+    if ((fingerprints = __malloc(zxcvbn, n_slots)) == NULL ||
+            (xors = __malloc(zxcvbn, sizeof(*xors) * n_slots)) == NULL ||
+            (counts = __malloc(zxcvbn, sizeof(*counts) * n_slots)) == NULL ||
+            (queue = __malloc(zxcvbn, sizeof(*queue) * n_slots)) == NULL ||
+            (stack = __malloc(zxcvbn, sizeof(*stack) * MAX(n, 1))) == NULL)
+        goto out;
+
+    for (i = 0; i < ZXCVBN_BREACH_SEEDS_MAX; ++i) {
+        image.seed = hash_mix(FNV_OFFSET + i);
+        if (breach_filter(breach, image.seed, image.block_len, fingerprints,
+                          xors, counts, queue, stack) == 0)
+            break;
+    }
+    if (i == ZXCVBN_BREACH_SEEDS_MAX)
+        goto out;
+
+    if ((file = fopen(tmp_path, "w")) == NULL)
+        goto out;
+    if (fwrite(&image, sizeof(image), 1, file) != 1)
+        goto out;
+    for (k = 0; k < n; ++k) {
+        if (fwrite(&breach->entries[k].hash, sizeof(uint64_t), 1, file) != 1)
+            goto out;
+    }
+    for (k = 0; k < n; ++k) {
+        if (fwrite(&breach->entries[k].rank, sizeof(uint32_t), 1, file) != 1)
+            goto out;
+    }
+    if (fwrite(fingerprints, 1, n_slots, file) != n_slots)
+        goto out;
+
+    ret = fclose(file);
+    file = NULL;
+    // processes that have mapped the old image keep using it
+    if (ret == 0)
+        ret = rename(tmp_path, path);
+
+out:
+    if (file != NULL)
+        fclose(file);
+    if (ret < 0)
+        unlink(tmp_path);
+    __free(zxcvbn, fingerprints);
+    __free(zxcvbn, xors);
+    __free(zxcvbn, counts);
+    __free(zxcvbn, queue);
+    __free(zxcvbn, stack);
+    return ret;
+}
+
+struct zxcvbn_breach *
+zxcvbn_breach_load_mmap(struct zxcvbn *zxcvbn, const char *path)
+{
+    const struct zxcvbn_breach_image *image;
+    struct zxcvbn_breach *breach;
+    struct stat st;
+    size_t n;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(*image)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    // lookups stay in the image whatever its entries, which are not checked
+    image = map;
+    n = image->n_entries;
+    if (memcmp(image->magic, ZXCVBN_BREACH_IMAGE_MAGIC, sizeof(ZXCVBN_BREACH_IMAGE_MAGIC)) != 0 ||
+            image->version != ZXCVBN_BREACH_IMAGE_VERSION ||
+            image->byte_order != ZXCVBN_BREACH_IMAGE_ORDER ||
+            (n > 0 && image->block_len == 0) ||
+            st.st_size != sizeof(*image) + n * (sizeof(uint64_t) + sizeof(uint32_t)) +
+                          3 * (size_t) image->block_len)
+        goto err;
+
+    if ((breach = zxcvbn_breach_init(zxcvbn)) == NULL)
+        goto err;
+
+    breach->map = map;
+    breach->map_size = st.st_size;
+    breach->image = image;
+    breach->hashes = (const uint64_t *) (image + 1);
+    breach->ranks = (const uint32_t *) (breach->hashes + n);
+    breach->fingerprints = (const uint8_t *) (breach->ranks + n);
+
+    zxcvbn_breach_release(zxcvbn->breach);
+    zxcvbn->breach = breach;
+    cache_invalidate(zxcvbn);
+
+    return breach;
+
+err:
+    munmap(map, st.st_size);
+    return NULL;
+}
+
+void
+zxcvbn_breach_release(struct zxcvbn_breach *breach)
+{
+    struct zxcvbn *zxcvbn;
+
+    if (breach == NULL)
+        return;
+
+    zxcvbn = breach->zxcvbn;
+    if (zxcvbn->breach == breach) {
+        zxcvbn->breach = NULL;
+        cache_invalidate(zxcvbn);
+    }
+
+    if (breach->map != NULL)
+        munmap(breach->map, breach->map_size);
+    __free(zxcvbn, breach->entries);
+    __free(zxcvbn, breach);
+}
+
+/* Breach corpus ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Stats ==================================================================== */
+
+#define ZXCVBN_STATS_SHARDS     16
+
+// a shard per cache line, threads take them in turn
+struct zxcvbn_stats_shard {
+    struct zxcvbn_stats stats;
+} __attribute__((aligned(64)));
+
+static unsigned int stats_next_shard;
+static __thread unsigned int stats_shard;
+
+static int
+stats_init(struct zxcvbn *zxcvbn)
+{
+    size_t size = sizeof(struct zxcvbn_stats_shard) * ZXCVBN_STATS_SHARDS;
+    uintptr_t align = __alignof__(struct zxcvbn_stats_shard);
+
+    if ((zxcvbn->stats_block = __malloc(zxcvbn, size + align - 1)) == NULL)
+        return -1;
+    zxcvbn->stats = (struct zxcvbn_stats_shard *)
+        (((uintptr_t) zxcvbn->stats_block + align - 1) & ~(align - 1));
+    memset(zxcvbn->stats, 0, size);
+
+    return 0;
+}
+
+// ns of a monotonic clock, 0 if stats are disabled
+static inline uint64_t
+stats_clock(const struct zxcvbn_res *res)
+{
+    struct timespec ts;
+
+    if (res->zxcvbn->stats == NULL)
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// the time since *t goes to stage, *t is restarted
+static inline void
+stats_stage(struct zxcvbn_res *res, enum zxcvbn_stage stage, uint64_t *t)
+{
+    uint64_t now;
+
+    if (res->zxcvbn->stats == NULL)
+        return;
+    now = stats_clock(res);
+    res->stats.stage_ns[stage] += now - *t;
+    *t = now;
+}
+
+static inline void
+stats_begin(struct zxcvbn_res *res)
+{
+    if (res->zxcvbn->stats != NULL)
+        memset(&res->stats, 0, sizeof(res->stats));
+}
+
+// count the candidates and add the stats of res to the shard of the thread
+static void
+stats_end(struct zxcvbn_res *res)
+{
+    const struct zxcvbn_candidates *cands = &res->candidates;
+    const uint64_t *src = (const uint64_t *) &res->stats;
+    uint64_t *dst;
+    unsigned int k;
+
+    if (res->zxcvbn->stats == NULL)
+        return;
+
+    res->stats.calls = 1;
+    for (k = 0; k < cands->n; ++k)
+        res->stats.matches[cands->type[k]]++;
+
+    if (stats_shard == 0)
+        stats_shard = __atomic_fetch_add(&stats_next_shard, 1, __ATOMIC_RELAXED) %
+                      ZXCVBN_STATS_SHARDS + 1;
+    dst = (uint64_t *) &res->zxcvbn->stats[stats_shard - 1].stats;
+    for (k = 0; k < sizeof(res->stats) / sizeof(uint64_t); ++k) {
+        if (src[k] != 0)
+            __atomic_fetch_add(dst + k, src[k], __ATOMIC_RELAXED);
+    }
+}
+
+int
+zxcvbn_stats_get(struct zxcvbn *zxcvbn, struct zxcvbn_stats *stats)
+{
+    uint64_t *dst = (uint64_t *) stats;
+    const uint64_t *src;
+    unsigned int i, k;
+
+    memset(stats, 0, sizeof(*stats));
+    if (zxcvbn->stats == NULL)
+        return -1;
+
+    for (i = 0; i < ZXCVBN_STATS_SHARDS; ++i) {
+        src = (const uint64_t *) &zxcvbn->stats[i].stats;
+        for (k = 0; k < sizeof(*stats) / sizeof(uint64_t); ++k)
+            dst[k] += __atomic_load_n(src + k, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+void
+zxcvbn_stats_reset(struct zxcvbn *zxcvbn)
+{
+    uint64_t *dst;
+    unsigned int i, k;
+
+    if (zxcvbn->stats == NULL)
+        return;
+
+    for (i = 0; i < ZXCVBN_STATS_SHARDS; ++i) {
+        dst = (uint64_t *) &zxcvbn->stats[i].stats;
+        for (k = 0; k < sizeof(struct zxcvbn_stats) / sizeof(uint64_t); ++k)
+            __atomic_store_n(dst + k, 0, __ATOMIC_RELAXED);
+    }
+}
+
+const char *
+zxcvbn_stage_string(enum zxcvbn_stage stage)
+{
+    static const char *const names[ZXCVBN_STAGES_NUM] = {
+        [ZXCVBN_STAGE_ANALYZE]      = "analyze",
+        [ZXCVBN_STAGE_SPATIAL]      = "spatial",
+        [ZXCVBN_STAGE_DIGITS]       = "digits",
+        [ZXCVBN_STAGE_DATE]         = "date",
+        [ZXCVBN_STAGE_SEQUENCE]     = "sequence",
+        [ZXCVBN_STAGE_REPEAT]       = "repeat",
+        [ZXCVBN_STAGE_BREACH]       = "breach",
+        [ZXCVBN_STAGE_DICT]         = "dict",
+        [ZXCVBN_STAGE_ENTROPY]      = "entropy",
+        [ZXCVBN_STAGE_MIN_ENTROPY]  = "min_entropy",
+    };
+
+    assert(stage < ZXCVBN_STAGES_NUM);
+    return names[stage];
+}
+
+/* Stats ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+// rebuild masks of active layouts
+static void
+layouts_update(struct zxcvbn *zxcvbn)
+{
+    const struct zxcvbn_spatial_graph *spatial_graph;
+    unsigned int g, ch;
+    uint32_t bit;
+
+    cache_invalidate(zxcvbn);
+    memset(zxcvbn->layout_masks, 0, sizeof(zxcvbn->layout_masks));
+    zxcvbn->wide_layouts = 0;
+
+    for (g = 0; g < zxcvbn->n_layouts; ++g) {
+        bit = (uint32_t) 1 << g;
+        if (!(zxcvbn->active_layouts & bit))
+            continue;
+
+        spatial_graph = zxcvbn->layouts[g];
+        for (ch = 0; ch < ARRAY_SIZE(zxcvbn->layout_masks); ++ch) {
+            if (spatial_graph->keys[ch] != ZXCVBN_KEY_NONE)
+                zxcvbn->layout_masks[ch] |= bit;
+        }
+        if (spatial_graph->n_wide_keys > 0)
+            zxcvbn->wide_layouts |= bit;
+    }
+}
+
+struct zxcvbn *
+zxcvbn_init_ex(struct zxcvbn *zxcvbn, struct zxcvbn_opts *opts)
+{
+    static struct zxcvbn_opts default_opts;
+    zxcvbn_malloc_t malloc_;
+    int i;
+    const unsigned char *s;
+
+    if (!opts)
+        opts = &default_opts;
+    malloc_ = (opts->malloc ? opts->malloc : malloc);
+
+    if (zxcvbn)
+        memset(zxcvbn, 0, sizeof(*zxcvbn));
+    else {
+        if (!(zxcvbn = malloc_(sizeof(*zxcvbn))))
+            return NULL;
+        memset(zxcvbn, 0, sizeof(*zxcvbn));
+        zxcvbn->allocated = 1;
+    }
+
+    zxcvbn->zxcvbn_malloc = malloc_;
+    if (opts->malloc) {
+        assert(opts->realloc);
+        assert(opts->free);
+
+        zxcvbn->zxcvbn_realloc = opts->realloc;
+        zxcvbn->zxcvbn_free = opts->free;
+    } else {
+        assert(!opts->realloc);
+        assert(!opts->free);
+
+        zxcvbn->zxcvbn_realloc = realloc;
+        zxcvbn->zxcvbn_free = free;
+    }
+
+    zxcvbn->max_matches_num = opts->max_matches_num;
+    zxcvbn->skipped_match_types = opts->skipped_match_types;
+
+    LIST_INIT(&zxcvbn->dict_head);
+
+    memset(zxcvbn->pack_table, '.', sizeof(zxcvbn->pack_table));
+
+    for (i = 'a'; i <= 'z'; ++i)
+        zxcvbn->pack_table[i] = zxcvbn->pack_table_size++;
+
+    for (i = '0'; i <= '9'; ++i)
+        zxcvbn->pack_table[i] = zxcvbn->pack_table_size++;
+
+    for (s = (void *) opts->symbols; *s != '\0'; ++s) {
+        if (zxcvbn->pack_table[*s] == '.') {
+            zxcvbn->pack_table[*s] = zxcvbn->pack_table_size++;
+            zxcvbn->n_symbols++;
+        }
+    }
+
+    // l33t
+    for (i = 0; i < 256; ++i) {
+        if (l33t_table[i])
+            zxcvbn->pack_table[i] = zxcvbn->pack_table[l33t_table[i]];
+    }
+
+    zxcvbn->layouts[zxcvbn->n_layouts++] = &spatial_graph_qwerty;
+    zxcvbn->layouts[zxcvbn->n_layouts++] = &spatial_graph_dvorak;
+    zxcvbn->layouts[zxcvbn->n_layouts++] = &spatial_graph_keypad;
+    zxcvbn->layouts[zxcvbn->n_layouts++] = &spatial_graph_macpad;
+    zxcvbn->active_layouts = ((uint32_t) 1 << zxcvbn->n_layouts) - 1;
+    layouts_update(zxcvbn);
+
+    for (i = 0; i < ARRAY_SIZE(builtin_sequences); ++i)
+        zxcvbn->sequences[zxcvbn->n_sequences++] = builtin_sequences[i];
+    zxcvbn->sequence_masks = sequence_masks;
+    if (opts->n_sequences > 0 && sequences_add(zxcvbn, opts->sequences, opts->n_sequences) < 0) {
+        zxcvbn_release(zxcvbn);
+        return NULL;
+    }
+
+    if (opts->cache_size > 0 && cache_init(zxcvbn, opts->cache_size) < 0) {
+        zxcvbn_release(zxcvbn);
+        return NULL;
+    }
+
+    if (opts->stats && stats_init(zxcvbn) < 0) {
+        zxcvbn_release(zxcvbn);
+        return NULL;
+    }
+
+    return zxcvbn;
+}
+
+struct zxcvbn *
+zxcvbn_init(struct zxcvbn *zxcvbn_buf,
+            void *(*zxcvbn_malloc)(size_t size),
+            void *(*zxcvbn_realloc)(void *ptr, size_t size),
+            void (*zxcvbn_free)(void *ptr),
+            const char *symbols)
+{
+    struct zxcvbn_opts opts;
+
+    zxcvbn_opts_init(&opts);
+    opts.malloc = zxcvbn_malloc;
+    opts.realloc = zxcvbn_realloc;
+    opts.free = zxcvbn_free;
+    opts.symbols = symbols;
+    return zxcvbn_init_ex(zxcvbn_buf, &opts);
+}
+
+// candidates by end position
+struct candidate_order {
+    int *order;
+    int n_ordered;
+    // first of the candidates ending at pos
+    int *ends;
+    // longest candidate not starting the password
+    unsigned int span;
+    int ends_buf[ZXCVBN_STACK_LEN];
+    int order_buf[256];
+};
+
+static void
+candidates_order_release(struct zxcvbn_res *res, struct candidate_order *o)
+{
+    scratch_put(res, o->order, o->order_buf);
+    scratch_put(res, o->ends, o->ends_buf);
+}
+
+/*
+ * Counting sort of candidates by end position, stable so that the first of
+ * equally good matches still wins. Candidates from first on come before
+ * those added earlier.
+ */
+static int
+candidates_order(struct zxcvbn_res *res, struct candidate_order *o,
+                 unsigned int password_len, unsigned int first)
+{
+    const struct zxcvbn_candidates *cands = &res->candidates;
+    int k, match_i, pos;
+
+    o->order = NULL;
+    o->ends = scratch_get(res, SCRATCH_ENDS, o->ends_buf, sizeof(o->ends_buf),
+                          password_len * sizeof(*o->ends));
+    if (o->ends == NULL)
+        return -1;
+
+    memset(o->ends, 0, password_len * sizeof(o->ends[0]));
+    o->span = 0;
+    for (match_i = 0; match_i < cands->n; ++match_i) {
+        if (cands->j[match_i] < password_len) {
+            ++o->ends[cands->j[match_i]];
+            if (cands->i[match_i] > 0)
+                o->span = MAX(o->span, cands->j[match_i] - cands->i[match_i] + 1);
+        }
+    }
+    for (pos = 1; pos < password_len; ++pos)
+        o->ends[pos] += o->ends[pos - 1];
+
+    o->n_ordered = o->ends[password_len - 1];
+
+    o->order = scratch_get(res, SCRATCH_ORDER, o->order_buf, sizeof(o->order_buf),
+                           o->n_ordered * sizeof(*o->order));
+    if (o->order == NULL) {
+        candidates_order_release(res, o);
+        return -1;
+    }
+    for (k = cands->n - 1; k >= 0; --k) {
+        match_i = k < cands->n - first ? first + k : k - (cands->n - first);
+        if (cands->j[match_i] < password_len)
+            o->order[--o->ends[cands->j[match_i]]] = match_i;
+    }
+    // now ends[pos] is the first match ending at pos
+
+    return 0;
+}
+
+/*
+ * Lowest entropy of each prefix of the password, the entries before from are
+ * kept. matches has the position in the order of the last match of each
+ * prefix or -1 if it ends with bruteforce. The entropy of prefix pos is at
+ * pos & mask, so with a mask of at least o->span only a window of the last
+ * prefixes is kept.
+ */
+static void
+min_entropy_prefixes(struct zxcvbn_res *res, const struct candidate_order *o,
+                     unsigned int from, unsigned int password_len,
+                     double bruteforce_entropy, double *pos_entropy,
+                     unsigned int mask, int *matches)
+{
+    const struct zxcvbn_candidates *cands = &res->candidates;
+    int k, end, pos, match_i;
+    double entropy, min;
+
+    for (pos = from; pos < password_len; ++pos) {
+        min = pos > 0 ? pos_entropy[(pos - 1) & mask] : 0;
+        min += bruteforce_entropy;
+        matches[pos] = -1;
+
+        end = pos + 1 < password_len ? o->ends[pos + 1] : o->n_ordered;
+        for (k = o->ends[pos]; k < end; ++k) {
+            match_i = o->order[k];
+
+            entropy = cands->i[match_i] > 0 ? pos_entropy[(cands->i[match_i] - 1) & mask] : 0;
+            entropy += cands->entropy[match_i];
+
+            if (min > entropy) {
+                min = entropy;
+                matches[pos] = k;
+            }
+        }
+        pos_entropy[pos & mask] = min;
+    }
+}
+
+// fill in the matches of the lowest entropy path of the whole password
+static int
+min_entropy_path(struct zxcvbn_res *res, const struct candidate_order *o,
+                 unsigned int password_len, unsigned int bruteforce_card,
+                 const int *matches)
+{
+    const struct zxcvbn_candidates *cands = &res->candidates;
+    int i, end, pos, match_i, path_buf[ZXCVBN_STACK_LEN], *path, path_len;
+    struct zxcvbn_match *match;
+
+    path = scratch_get(res, SCRATCH_PATH, path_buf, sizeof(path_buf),
+                       password_len * sizeof(*path));
+    if (path == NULL)
+        return -1;
+
+    // walk the path back, a bruteforce gap is stored as -1 - its end
+    for (i = password_len - 1, end = -1, path_len = 0; i >= 0;) {
+        if (matches[i] < 0) {
+            end = end < 0 ? i : end;
+            i--;
+        } else {
+            if (end >= 0) {
+                path[path_len++] = -1 - end;
+                end = -1;
+            }
+            match_i = o->order[matches[i]];
+            path[path_len++] = match_i;
+            i = cands->i[match_i] - 1;
+        }
+    }
+    if (end >= 0)
+        path[path_len++] = -1 - end;
+
+    res->n_matches = 0;
+    for (pos = 0; path_len-- > 0; pos = match->j + 1) {
+        if (path[path_len] < 0)
+            match = push_match_bruteforce(res, pos, -1 - path[path_len],
+                                          bruteforce_card);
+        else if ((match = match_add(res)) != NULL)
+            match_fill(match, cands, path[path_len]);
+        if (match == NULL)
+            break;
+    }
+    scratch_put(res, path, path_buf);
+    if (path_len >= 0)
+        return -1;
+
+    // matches may have moved while being added, link them after
+    CIRCLEQ_INIT(&res->match_head);
+    for (i = 0; i < res->n_matches; i++)
+        CIRCLEQ_INSERT_TAIL(&res->match_head, res->matches + i, list);
+
+    return 0;
+}
+
+/*
+ * No match not starting the password is longer than o.span, so the entropy
+ * of prefixes is kept in a window of the next power of two positions. Only
+ * the matches of every prefix are needed for the whole password, to walk
+ * the path back.
+ */
+static int
+min_entropy(struct zxcvbn_res *res, const struct zxcvbn_analysis *analysis,
+            const char *password, unsigned int password_len)
+{
+    int matches_buf[ZXCVBN_STACK_LEN], *matches;
+    double window_buf[ZXCVBN_STACK_LEN], *window;
+    unsigned int bruteforce_card, window_len;
+    struct candidate_order o;
+    int ret;
+
+    assert(password_len > 0);
+
+    if (candidates_order(res, &o, password_len, 0) < 0)
+        return -1;
+
+    window_len = 2;
+    while (window_len <= o.span)
+        window_len *= 2;
+
+    ret = -1;
+    matches = scratch_get(res, SCRATCH_MATCHES, matches_buf, sizeof(matches_buf),
+                          password_len * sizeof(*matches));
+    window = scratch_get(res, SCRATCH_WINDOW, window_buf, sizeof(window_buf),
+                         window_len * sizeof(*window));
+    if (matches == NULL || window == NULL)
+        goto out;
+
+    bruteforce_card = calc_bruteforce_card(analysis->class_mask, res->zxcvbn->n_symbols);
+    min_entropy_prefixes(res, &o, 0, password_len, log2(bruteforce_card),
+                         window, window_len - 1, matches);
+    res->entropy = window[(password_len - 1) & (window_len - 1)];
+
+    ret = min_entropy_path(res, &o, password_len, bruteforce_card, matches);
+
+out:
+    scratch_put(res, matches, matches_buf);
+    scratch_put(res, window, window_buf);
+    candidates_order_release(res, &o);
+
+    return ret;
+}
+
+/*
+ * Readers count themselves in the counter of the current epoch before they
+ * load the set. After replacing the set a writer flips the epoch and waits
+ * for the counter of the previous one to drain, twice, so no reader can
+ * still hold the old set.
+ */
+static struct zxcvbn_dict_set *
+dict_set_pin(struct zxcvbn *zxcvbn, unsigned int *epoch)
+{
+    *epoch = __atomic_load_n(&zxcvbn->dict_set_epoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_fetch_add(&zxcvbn->dict_set_readers[*epoch], 1, __ATOMIC_SEQ_CST);
+
+    return __atomic_load_n(&zxcvbn->dict_set, __ATOMIC_SEQ_CST);
+}
+
+static void
+dict_set_unpin(struct zxcvbn *zxcvbn, unsigned int epoch)
+{
+    __atomic_fetch_sub(&zxcvbn->dict_set_readers[epoch], 1, __ATOMIC_RELEASE);
+}
+
+// all but dictionary matches
+static int
+match_patterns(struct zxcvbn_res *res, const struct zxcvbn_analysis *analysis,
+               const char *password, unsigned int password_len,
+               const struct zxcvbn_date *dates, unsigned int dates_num)
+{
+    struct zxcvbn *zxcvbn = res->zxcvbn;
+    uint64_t t = stats_clock(res);
+
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_SPATIAL_M)
+            && match_spatial(res, password, password_len, NULL))
+        return -1;
+    stats_stage(res, ZXCVBN_STAGE_SPATIAL, &t);
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_DIGITS_M)
+            && match_digits(res, analysis, password_len))
+        return -1;
+    stats_stage(res, ZXCVBN_STAGE_DIGITS, &t);
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_DATE_M)
+            && zxcvbn_date_match(res, analysis, password, password_len,
+                                 dates, dates_num))
+        return -1;
+    stats_stage(res, ZXCVBN_STAGE_DATE, &t);
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_SEQUENCE_M)
+            && zxcvbn_sequence_match(res, password, password_len, NULL))
+        return -1;
+    stats_stage(res, ZXCVBN_STAGE_SEQUENCE, &t);
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_REPEAT_M)
+            && zxcvbn_repeat_match(res, analysis, password_len))
+        return -1;
+    stats_stage(res, ZXCVBN_STAGE_REPEAT, &t);
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_BREACH_M)
+            && match_breach(res, password, password_len))
+        return -1;
+    stats_stage(res, ZXCVBN_STAGE_BREACH, &t);
+    return 0;
+}
+
+// entropy of candidates added since the first one
+static void
+candidates_entropy(struct zxcvbn_res *res, const struct zxcvbn_analysis *analysis,
+                   const char *password, unsigned int first)
+{
+    struct zxcvbn *zxcvbn = res->zxcvbn;
+    struct zxcvbn_candidates *cands = &res->candidates;
+    unsigned int k;
+    double entropy;
+
+    for (k = first; k < cands->n; ++k) {
+        switch (cands->type[k]) {
+        case ZXCVBN_MATCH_TYPE_DICT:
+            entropy = entropy_dict(zxcvbn, cands, k, analysis);
+            break;
+        case ZXCVBN_MATCH_TYPE_BREACH:
+            entropy = rank_entropy(cands->aux[k].rank);
+            break;
+        case ZXCVBN_MATCH_TYPE_SPATIAL:
+            entropy = entropy_spatial(zxcvbn, cands, k, analysis);
+            break;
+        case ZXCVBN_MATCH_TYPE_DIGITS:
+            entropy = entropy_digits(zxcvbn, cands, k);
+            break;
+        case ZXCVBN_MATCH_TYPE_SEQUENCE:
+            entropy = zxcvbn_sequence_calculate_entropy(zxcvbn, cands, k,
+                                                        password);
+            break;
+        case ZXCVBN_MATCH_TYPE_REPEAT:
+            entropy = zxcvbn_repeat_calculate_entropy(zxcvbn, cands, k,
+                                                      analysis);
+            break;
+        case ZXCVBN_MATCH_TYPE_DATE:
+            entropy = zxcvbn_date_calculate_entropy(zxcvbn, cands, k);
+            break;
+        default:
+            assert(0);
+            continue;
+        }
+        cands->entropy[k] = entropy;
+    }
+}
+
+static int
+match_analyzed(struct zxcvbn_res *res, const struct zxcvbn_dict_set *set,
+               const struct zxcvbn_analysis *analysis,
+               const char *password,            unsigned int password_len,
+               const char *const *words,        unsigned int words_num,
+               const struct zxcvbn_date *dates, unsigned int dates_num)
+{
+    uint64_t t;
+    int ret;
+
+    if (match_patterns(res, analysis, password, password_len,
+                       dates, dates_num) < 0)
+        return -1;
+    t = stats_clock(res);
+    if (!(res->zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_REPEAT_M)
+            && match_dict(res, set, analysis, password_len, words, words_num))
+        return -1;
+    stats_stage(res, ZXCVBN_STAGE_DICT, &t);
+
+    candidates_entropy(res, analysis, password, 0);
+    stats_stage(res, ZXCVBN_STAGE_ENTROPY, &t);
+    ret = min_entropy(res, analysis, password, password_len);
+    stats_stage(res, ZXCVBN_STAGE_MIN_ENTROPY, &t);
+
+    return ret;
+}
+
+static int
+match_ex(struct zxcvbn_res *res, const struct zxcvbn_dict_set *set,
+         const char *password,            unsigned int password_len,
+         const char *const *words,        unsigned int words_num,
+         const struct zxcvbn_date *dates, unsigned int dates_num)
+{
+    struct zxcvbn_analysis analysis;
+    uint64_t t;
+    int ret;
+
+    assert(password_len > 0);
+
+    if (!dates)
+        dates_num = 0;
+
+    t = stats_clock(res);
+    if (analyze(res, &analysis, password, password_len) < 0)
+        return -1;
+    stats_stage(res, ZXCVBN_STAGE_ANALYZE, &t);
+
+    ret = match_analyzed(res, set, &analysis, password, password_len,
+                         words, words_num, dates, dates_num);
+
+    analysis_release(res, &analysis);
+    return ret;
+}
+
+/*
+ * generation is read before set is pinned, so that a result is never stored
+ * with the generation of a newer set than the one it was matched with
+ */
+static int
+match_cached(struct zxcvbn_res *res, const struct zxcvbn_dict_set *set,
+             unsigned long generation,
+             const char *password,            unsigned int password_len,
+             const char *const *words,        unsigned int words_num,
+             const struct zxcvbn_date *dates, unsigned int dates_num)
+{
+    struct zxcvbn_cache_slot *slot;
+    uint64_t hash;
+    int ret;
+
+    if (res->zxcvbn->cache == NULL || password_len > CACHE_PASSWORD_LEN)
+        return match_ex(res, set, password, password_len, words, words_num,
+                        dates, dates_num);
+
+    if (!dates)
+        dates_num = 0;
+    hash = cache_hash(words, words_num, dates, dates_num);
+    slot = cache_slot(res->zxcvbn, password, password_len, hash);
+
+    if ((ret = cache_lookup(res, slot, generation, hash, password, password_len)) != 0)
+        return ret < 0 ? -1 : 0;
+
+    if (match_ex(res, set, password, password_len, words, words_num,
+                 dates, dates_num) < 0)
+        return -1;
+    cache_store(res, slot, generation, hash, password, password_len);
+
+    return 0;
+}
+
+/*
+ * Entropy only goes down as matches are added, so bruteforce over the whole
+ * password bounds it from above: a password failing with the bound is not
+ * matched at all. Otherwise matching is done as by match_ex(), a pass with
+ * only a part of the matches costs more than it saves.
+ */
+static int
+check_analyzed(struct zxcvbn_res *res, const struct zxcvbn_dict_set *set,
+               const struct zxcvbn_analysis *analysis,
+               const char *password,            unsigned int password_len,
+               const char *const *words,        unsigned int words_num,
+               const struct zxcvbn_date *dates, unsigned int dates_num,
+               double min_bits, uint64_t t)
+{
+    unsigned int bruteforce_card;
+    struct zxcvbn_match *match;
+
+    bruteforce_card = calc_bruteforce_card(analysis->class_mask, res->zxcvbn->n_symbols);
+    if (password_len * log2(bruteforce_card) < min_bits) {
+        res->n_matches = 0;
+        if ((match = push_match_bruteforce(res, 0, password_len - 1, bruteforce_card)) == NULL)
+            return -1;
+        CIRCLEQ_INIT(&res->match_head);
+        CIRCLEQ_INSERT_TAIL(&res->match_head, match, list);
+        res->entropy = match->entropy;
+        stats_stage(res, ZXCVBN_STAGE_MIN_ENTROPY, &t);
+        return 0;
+    }
+
+    if (match_analyzed(res, set, analysis, password, password_len,
+                       words, words_num, dates, dates_num) < 0)
+        return -1;
+    return res->entropy >= min_bits;
+}
+
+static int
+check_threshold(struct zxcvbn_res *res, const struct zxcvbn_dict_set *set,
+                const char *password,            unsigned int password_len,
+                const char *const *words,        unsigned int words_num,
+                const struct zxcvbn_date *dates, unsigned int dates_num,
+                double min_bits)
+{
+    struct zxcvbn_analysis analysis;
+    uint64_t t;
+    int ret;
+
+    assert(password_len > 0);
+
+    if (!dates)
+        dates_num = 0;
+
+    t = stats_clock(res);
+    if (analyze(res, &analysis, password, password_len) < 0)
+        return -1;
+    stats_stage(res, ZXCVBN_STAGE_ANALYZE, &t);
+    ret = check_analyzed(res, set, &analysis, password, password_len,
+                         words, words_num, dates, dates_num, min_bits, t);
+    analysis_release(res, &analysis);
+
+    return ret;
+}
+
+int
+zxcvbn_match_ex(struct zxcvbn_res *res,
+                const char *password,            unsigned int password_len,
+                const char *const *words,        unsigned int words_num,
+                const struct zxcvbn_date *dates, unsigned int dates_num)
+{
+    struct zxcvbn_dict_set *set;
+    unsigned long generation;
+    unsigned int epoch;
+    int ret;
+
+    stats_begin(res);
+    generation = __atomic_load_n(&res->zxcvbn->cache_generation, __ATOMIC_SEQ_CST);
+    set = dict_set_pin(res->zxcvbn, &epoch);
+    ret = match_cached(res, set, generation, password, password_len,
+                       words, words_num, dates, dates_num);
+    dict_set_unpin(res->zxcvbn, epoch);
+    stats_end(res);
+
+    return ret;
+}
+
+int
+zxcvbn_check_threshold(struct zxcvbn_res *res,
+                       const char *password,            unsigned int password_len,
+                       const char *const *words,        unsigned int words_num,
+                       const struct zxcvbn_date *dates, unsigned int dates_num,
+                       double min_bits)
+{
+    struct zxcvbn_dict_set *set;
+    unsigned int epoch;
+    int ret;
+
+    stats_begin(res);
+    set = dict_set_pin(res->zxcvbn, &epoch);
+    ret = check_threshold(res, set, password, password_len, words, words_num,
+                          dates, dates_num, min_bits);
+    dict_set_unpin(res->zxcvbn, epoch);
+    stats_end(res);
+
+    return ret;
+}
+
+int
+zxcvbn_match_batch(struct zxcvbn *zxcvbn,
+                   struct zxcvbn_batch_item *items, unsigned int n_items,
+                   struct zxcvbn_res *results)
+{
+    struct zxcvbn_res shared, *res;
+    struct zxcvbn_scratch scratch;
+    struct zxcvbn_batch_item *item;
+    struct zxcvbn_dict_set *set;
+    unsigned long generation;
+    unsigned int i, epoch;
+    int ret;
+
+    if (results != NULL) {
+        for (i = 0; i < n_items; ++i)
+            zxcvbn_res_init(results + i, zxcvbn);
+    }
+
+    // without results every item reuses the match buffer of the previous one
+    zxcvbn_res_init(&shared, zxcvbn);
+    memset(&scratch, 0, sizeof(scratch));
+    ret = 0;
+
+    for (i = 0; i < n_items && ret == 0; ++i) {
+        item = items + i;
+        if (results != NULL)
+            res = results + i;
+        else {
+            res = &shared;
+            zxcvbn_res_reset(res);
+        }
+
+        // pinned per item, so that replacing the set waits for one item only
+        res->scratch = &scratch;
+        stats_begin(res);
+        generation = __atomic_load_n(&zxcvbn->cache_generation, __ATOMIC_SEQ_CST);
+        set = dict_set_pin(zxcvbn, &epoch);
+        if (match_cached(res, set, generation, item->password, item->password_len,
+                         item->words, item->words_num,
+                         item->dates, item->dates ? item->dates_num : 0) < 0) {
+            res->entropy = 0;
+            ret = -1;
+        }
+        dict_set_unpin(zxcvbn, epoch);
+        stats_end(res);
+        res->scratch = NULL;
+        item->entropy = res->entropy;
+    }
+
+    scratch_release(zxcvbn, &scratch);
+    zxcvbn_res_release(&shared);
+
+    return ret;
+}
+
+int
+zxcvbn_match(struct zxcvbn_res *res,
+             const char *password,     unsigned int password_len,
+             const char *const *words, unsigned int words_num)
+{
+    return zxcvbn_match_ex(res, password, password_len, words, words_num,
+                           NULL, 0);
+}
+
+/* Session ================================================================== */
+
+/*
+ * Matchers of the candidates of a session in the order match_ex() adds them,
+ * a user word ranks by its index after the patterns and dictionaries come
+ * last.
+ */
+enum session_rank {
+    SESSION_RANK_SPATIAL,
+    SESSION_RANK_DIGITS,
+    SESSION_RANK_DATE,
+    SESSION_RANK_DATE_SEP,
+    SESSION_RANK_SEQUENCE,
+    SESSION_RANK_REPEAT,
+    SESSION_RANK_BREACH,
+    SESSION_RANK_WORDS,
+};
+
+#define SESSION_RANK_DICT   UINT32_MAX
+
+#define SESSION_CHAR_SIZE \
+    (sizeof(double) + sizeof(uint64_t) + 8 * sizeof(uint32_t) + 5 * sizeof(int) + \
+     2 * sizeof(uint8_t) + 2 * sizeof(char))
+
+struct zxcvbn_session *
+zxcvbn_session_init(struct zxcvbn *zxcvbn, struct zxcvbn_session *session_buf,
+                    const char *const *words,        unsigned int words_num,
+                    const struct zxcvbn_date *dates, unsigned int dates_num)
+{
+    struct zxcvbn_session *session;
+
+    if (session_buf != NULL) {
+        session = session_buf;
+        session->allocated = 0;
+    } else {
+        if ((session = __malloc(zxcvbn, sizeof(struct zxcvbn_session))) == NULL)
+            return NULL;
+        session->allocated = 1;
+    }
+
+    zxcvbn_res_init(&session->res, zxcvbn);
+    CIRCLEQ_INIT(&session->res.match_head);
+    session->res.entropy = 0;
+    session->words = words;
+    session->words_num = words != NULL ? words_num : 0;
+    session->dates = dates;
+    session->dates_num = dates != NULL ? dates_num : 0;
+    session->password = NULL;
+    session->password_len = 0;
+    session->password_reserved = 0;
+    session->set = NULL;
+    session->set_generation = 0;
+    session->ranks = NULL;
+    session->order = NULL;
+    session->n_ranks_reserved = 0;
+    session->bruteforce_card = 0;
+    session->pos_entropy = NULL;
+
+    return session;
+}
+
+// a column of n entries of size at *p, the used ones are moved over from old
+static void *
+session_column(char **p, const void *old, size_t size, unsigned int n, unsigned int used)
+{
+    void *column = *p;
+
+    *p += n * size;
+    if (used)
+        memcpy(column, old, used * size);
+    return column;
+}
+
+/*
+ * Room for len chars in the columns of the session, kept in one block with
+ * the widest first. The columns of the password so far are moved over.
+ */
+static int
+session_reserve(struct zxcvbn_session *session, unsigned int len)
+{
+    struct zxcvbn *zxcvbn = session->res.zxcvbn;
+    unsigned int n, used, counts;
+    void *block;
+    char *p;
+
+    if (len <= session->password_reserved)
+        return 0;
+    n = MAX(len, session->password_reserved ? session->password_reserved * 2 : 64);
+    if ((p = __malloc(zxcvbn, n * SESSION_CHAR_SIZE + 3 * sizeof(uint32_t))) == NULL)
+        return -1;
+
+    block = session->pos_entropy;
+    used = session->password_reserved ? session->password_len : 0;
+    counts = session->password_reserved ? used + 1 : 0;
+    session->pos_entropy = session_column(&p, session->pos_entropy, sizeof(double), n, used);
+    session->hashes = session_column(&p, session->hashes, sizeof(uint64_t), n, used);
+    session->uppers = session_column(&p, session->uppers, sizeof(uint32_t), n + 1, counts);
+    session->lowers = session_column(&p, session->lowers, sizeof(uint32_t), n + 1, counts);
+    session->utf8_chars = session_column(&p, session->utf8_chars, sizeof(uint32_t), n + 1, counts);
+    session->char_starts = session_column(&p, session->char_starts, sizeof(uint32_t), n, used);
+    session->digit_starts = session_column(&p, session->digit_starts, sizeof(uint32_t), n, used);
+    session->spatial_fresh = session_column(&p, session->spatial_fresh, sizeof(uint32_t), n, used);
+    session->sequence_steps = session_column(&p, session->sequence_steps, sizeof(uint32_t), n, used);
+    session->date_steps = session_column(&p, session->date_steps, sizeof(uint32_t), n, used);
+    session->set_states = session_column(&p, session->set_states, sizeof(int), n, used);
+    session->states = session_column(&p, session->states, sizeof(int), n, used);
+    session->ends = session_column(&p, session->ends, sizeof(int), n, used);
+    session->path = session_column(&p, session->path, sizeof(int), n, used);
+    session->path_matches = session_column(&p, session->path_matches, sizeof(int), n, used);
+    session->classes = session_column(&p, session->classes, sizeof(uint8_t), n, used);
+    session->masks = session_column(&p, session->masks, sizeof(uint8_t), n, used);
+    session->pack = session_column(&p, session->pack, sizeof(char), n, used);
+    session->password = session_column(&p, session->password, sizeof(char), n, used);
+
+    if (session->password_reserved)
+        __free(zxcvbn, block);
+    session->password_reserved = n;
+
+    return 0;
+}
+
+/*
+ * Room for the ranks of n candidates. The order of the candidates is kept
+ * with them, as candidates of a session are kept by end it's the identity.
+ */
+static int
+session_reserve_ranks(struct zxcvbn_session *session, unsigned int n)
+{
+    struct zxcvbn *zxcvbn = session->res.zxcvbn;
+    uint32_t *ranks;
+    unsigned int k;
+    int *order;
+
+    if (n <= session->n_ranks_reserved)
+        return 0;
+    n = MAX(n, session->n_ranks_reserved ? session->n_ranks_reserved * 2 : 64);
+    if ((order = __malloc(zxcvbn, n * (sizeof(int) + sizeof(uint32_t)))) == NULL)
+        return -1;
+    ranks = (uint32_t *) (order + n);
+
+    for (k = 0; k < n; ++k)
+        order[k] = k;
+    if (session->n_ranks_reserved) {
+        memcpy(ranks, session->ranks, session->n_ranks_reserved * sizeof(uint32_t));
+        __free(zxcvbn, session->order);
+    }
+    session->order = order;
+    session->ranks = ranks;
+    session->n_ranks_reserved = n;
+
+    return 0;
+}
+
+/*
+ * Columns of the chars from from on: class, packed char, where its runs
+ * start and the hash of the password up to it. Counts of upper, lower and
+ * UTF-8 chars are of those before it negated, so that ANALYSIS_COUNT() still
+ * counts from i to j.
+ */
+static void
+session_analyze(struct zxcvbn_session *session, unsigned int from)
+{
+    struct zxcvbn *zxcvbn = session->res.zxcvbn;
+    const char *password = session->password;
+    unsigned int pos, class;
+    unsigned char ch;
+
+    if (from == 0) {
+        session->uppers[0] = 0;
+        session->lowers[0] = 0;
+        session->utf8_chars[0] = 0;
+    }
+
+    for (pos = from; pos < session->password_len; ++pos) {
+        ch = password[pos];
+        class = char_classes[ch];
+        session->classes[pos] = class;
+        session->pack[pos] = pack_char(zxcvbn, ch);
+        session->uppers[pos + 1] = session->uppers[pos] - !!(class & ZXCVBN_CLASS_UPPER);
+        session->lowers[pos + 1] = session->lowers[pos] - !!(class & ZXCVBN_CLASS_LOWER);
+        session->utf8_chars[pos + 1] = session->utf8_chars[pos] - ((ch & 0xc0) != 0x80);
+        session->path_matches[pos] = -1;
+
+        if (pos == 0) {
+            session->masks[pos] = class;
+            session->char_starts[pos] = pos;
+            session->digit_starts[pos] = pos;
+            session->hashes[pos] = fnv_hash(FNV_OFFSET, password, 1);
+            continue;
+        }
+        session->masks[pos] = session->masks[pos - 1] | class;
+        session->char_starts[pos] = ch == (unsigned char) password[pos - 1] ?
+                                    session->char_starts[pos - 1] : pos;
+        session->digit_starts[pos] = session->classes[pos - 1] & ZXCVBN_CLASS_DIGIT ?
+                                     session->digit_starts[pos - 1] : pos;
+        session->hashes[pos] = fnv_hash(session->hashes[pos - 1], password + pos, 1);
+    }
+}
+
+// the start of the piece of a run from start that has pos
+static inline unsigned int
+run_piece(unsigned int start, unsigned int pos)
+{
+    return start + (pos - start) / ZXCVBN_MATCH_SPAN_MAX * ZXCVBN_MATCH_SPAN_MAX;
+}
+
+/*
+ * Where each matcher has to look again when the first p chars are those the
+ * columns were found for. Matchers picking up a scan find again the matches
+ * starting from there, the others those ending from p on.
+ */
+static void
+session_resume(const struct zxcvbn_session *session, unsigned int p,
+               unsigned int from[SESSION_RANK_WORDS])
+{
+    unsigned int skipped = session->res.zxcvbn->skipped_match_types;
+    const uint8_t *classes = session->classes;
+    unsigned int rank;
+
+    for (rank = 0; rank < SESSION_RANK_WORDS; ++rank)
+        from[rank] = p;
+    from[SESSION_RANK_BREACH] = 0;
+    if (p == 0)
+        return;
+
+    // a char of the last bytes may not be complete yet
+    if (!(skipped & ZXCVBN_MATCH_TYPE_SPATIAL_M)) {
+        if ((unsigned char) session->password[p - 1] < 0x80)
+            from[SESSION_RANK_SPATIAL] = session->spatial_fresh[p - 1];
+        else
+            from[SESSION_RANK_SPATIAL] = p >= 4 ? session->spatial_fresh[p - 4] : 0;
+    }
+    if (!(skipped & ZXCVBN_MATCH_TYPE_DIGITS_M) && (classes[p - 1] & ZXCVBN_CLASS_DIGIT))
+        from[SESSION_RANK_DIGITS] = run_piece(session->digit_starts[p - 1], p - 1);
+    if (!(skipped & ZXCVBN_MATCH_TYPE_DATE_M)) {
+        if (classes[p - 1] & ZXCVBN_CLASS_DIGIT)
+            from[SESSION_RANK_DATE] = MAX(session->digit_starts[p - 1],
+                                          p > ZXCVBN_DATE_MAX_NOSEP_LEN - 1 ?
+                                          p - (ZXCVBN_DATE_MAX_NOSEP_LEN - 1) : 0);
+        from[SESSION_RANK_DATE_SEP] = p > ZXCVBN_DATE_MAX_SEP_LEN ?
+                                      session->date_steps[p - ZXCVBN_DATE_MAX_SEP_LEN - 1] : 0;
+    }
+    if (!(skipped & ZXCVBN_MATCH_TYPE_SEQUENCE_M))
+        from[SESSION_RANK_SEQUENCE] = session->sequence_steps[p - 1];
+    if (!(skipped & ZXCVBN_MATCH_TYPE_REPEAT_M))
+        from[SESSION_RANK_REPEAT] = run_piece(session->char_starts[p - 1], p - 1);
+}
+
+static void
+candidate_copy(struct zxcvbn_candidates *dst, unsigned int k,
+               const struct zxcvbn_candidates *src, unsigned int l)
+{
+    dst->entropy[k] = src->entropy[l];
+    dst->aux[k] = src->aux[l];
+    dst->i[k] = src->i[l];
+    dst->j[k] = src->j[l];
+    dst->type[k] = src->type[l];
+    dst->flags[k] = src->flags[l];
+}
+
+/*
+ * Drop the candidates from first on that are found again, the kept ones
+ * stay in order.
+ */
+static void
+session_drop(struct zxcvbn_session *session, unsigned int first, unsigned int p,
+             const unsigned int from[SESSION_RANK_WORDS])
+{
+    struct zxcvbn_candidates *cands = &session->res.candidates;
+    unsigned int k, n;
+    uint32_t rank;
+
+    for (k = n = first; k < cands->n; ++k) {
+        rank = session->ranks[k];
+        if (rank == SESSION_RANK_DATE || rank >= SESSION_RANK_WORDS ?
+                cands->j[k] >= p : cands->i[k] >= from[rank])
+            continue;
+        candidate_copy(cands, n, cands, k);
+        session->ranks[n++] = rank;
+    }
+    cands->n = n;
+}
+
+/*
+ * Candidates a matcher added from first on for the chars from offset on are
+ * moved there and ranked, those ending before min or past the password, as
+ * sequences may, are dropped.
+ */
+static int
+session_place(struct zxcvbn_session *session, unsigned int first, unsigned int offset,
+              unsigned int min, uint32_t rank)
+{
+    struct zxcvbn_candidates *cands = &session->res.candidates;
+    unsigned int k, n, j;
+
+    if (session_reserve_ranks(session, cands->n) < 0)
+        return -1;
+
+    for (k = n = first; k < cands->n; ++k) {
+        j = cands->j[k] + offset;
+        if (j < min || j >= session->password_len)
+            continue;
+        candidate_copy(cands, n, cands, k);
+        cands->i[n] += offset;
+        cands->j[n] = j;
+        session->ranks[n++] = rank;
+    }
+    cands->n = n;
+
+    return 0;
+}
+
+// steps of a matcher for the chars from offset on are moved there
+static void
+session_steps(uint32_t *steps, unsigned int offset, unsigned int len)
+{
+    unsigned int k;
+
+    for (k = offset; k < len; ++k)
+        steps[k] += offset;
+}
+
+/*
+ * The analysis of the chars from from on as matchers see it, their runs are
+ * found for the chars from runs_from on.
+ */
+static void
+session_window(const struct zxcvbn_session *session, struct zxcvbn_analysis *window,
+               const uint32_t *runs, unsigned int runs_from, unsigned int from)
+{
+    unsigned int n = session->password_len - runs_from;
+
+    window->classes = session->classes + from;
+    window->pack = session->pack + from;
+    window->char_runs = (uint32_t *) runs + (from - runs_from);
+    window->digit_runs = (uint32_t *) runs + n + (from - runs_from);
+}
+
+static int
+session_runs(struct zxcvbn_session *session, struct zxcvbn_analysis *window,
+             unsigned int from)
+{
+    struct zxcvbn_res *res = &session->res;
+    const char *password = session->password;
+    unsigned int i, n, len, run = 0, digit_run = 0;
+    unsigned char ch, next = 0;
+    uint32_t *runs;
+
+    len = session->password_len;
+    n = len - from;
+    runs = scratch_get(res, SCRATCH_ANALYSIS, window->buf, sizeof(window->buf),
+                       2 * n * sizeof(uint32_t));
+    if (runs == NULL)
+        return -1;
+    window->block = runs != window->buf ? runs : NULL;
+    window->class_mask = session->masks[len - 1];
+    window->uppers = NULL;
+    window->lowers = NULL;
+    window->utf8_chars = NULL;
+
+    for (i = len; i-- > from; next = ch) {
+        ch = password[i];
+        run = (i + 1 < len && ch == next) ? run + 1 : 1;
+        digit_run = (session->classes[i] & ZXCVBN_CLASS_DIGIT) ? digit_run + 1 : 0;
+        runs[i - from] = run;
+        runs[n + i - from] = digit_run;
+    }
+    session_window(session, window, runs, from, from);
+
+    return 0;
+}
+
+/*
+ * Patterns of the password from where each matcher has to look again, in
+ * windows of the password whose matches are moved in place.
+ */
+static int
+session_match_patterns(struct zxcvbn_session *session, struct zxcvbn_analysis *window,
+                       unsigned int runs_from, const unsigned int from[SESSION_RANK_WORDS],
+                       unsigned int p)
+{
+    struct zxcvbn_res *res = &session->res;
+    struct zxcvbn *zxcvbn = res->zxcvbn;
+    const char *password = session->password;
+    unsigned int len = session->password_len, k, at;
+    const uint32_t *runs = window->char_runs;
+    uint64_t t = stats_clock(res);
+
+    at = from[SESSION_RANK_SPATIAL];
+    k = res->candidates.n;
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_SPATIAL_M)) {
+        if (match_spatial(res, password + at, len - at, session->spatial_fresh + at) < 0 ||
+                session_place(session, k, at, 0, SESSION_RANK_SPATIAL) < 0)
+            return -1;
+        session_steps(session->spatial_fresh, at, len);
+    }
+    stats_stage(res, ZXCVBN_STAGE_SPATIAL, &t);
+
+    at = from[SESSION_RANK_DIGITS];
+    k = res->candidates.n;
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_DIGITS_M)) {
+        session_window(session, window, runs, runs_from, at);
+        if (match_digits(res, window, len - at) < 0 ||
+                session_place(session, k, at, 0, SESSION_RANK_DIGITS) < 0)
+            return -1;
+    }
+    stats_stage(res, ZXCVBN_STAGE_DIGITS, &t);
+
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_DATE_M)) {
+        at = from[SESSION_RANK_DATE];
+        k = res->candidates.n;
+        session_window(session, window, runs, runs_from, at);
+        if (zxcvbn_date_match_nosep(res, window, password + at, len - at,
+                                    session->dates, session->dates_num) < 0 ||
+                session_place(session, k, at, p, SESSION_RANK_DATE) < 0)
+            return -1;
+
+        at = from[SESSION_RANK_DATE_SEP];
+        k = res->candidates.n;
+        session_window(session, window, runs, runs_from, at);
+        if (zxcvbn_date_match_sep(res, window, password + at, len - at,
+                                  session->dates, session->dates_num,
+                                  session->date_steps + at) < 0 ||
+                session_place(session, k, at, 0, SESSION_RANK_DATE_SEP) < 0)
+            return -1;
+        session_steps(session->date_steps, at, len);
+    }
+    stats_stage(res, ZXCVBN_STAGE_DATE, &t);
+
+    at = from[SESSION_RANK_SEQUENCE];
+    k = res->candidates.n;
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_SEQUENCE_M)) {
+        if (zxcvbn_sequence_match(res, password + at, len - at,
+                                  session->sequence_steps + at) < 0 ||
+                session_place(session, k, at, 0, SESSION_RANK_SEQUENCE) < 0)
+            return -1;
+        session_steps(session->sequence_steps, at, len);
+    }
+    stats_stage(res, ZXCVBN_STAGE_SEQUENCE, &t);
+
+    at = from[SESSION_RANK_REPEAT];
+    k = res->candidates.n;
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_REPEAT_M)) {
+        session_window(session, window, runs, runs_from, at);
+        if (zxcvbn_repeat_match(res, window, len - at) < 0 ||
+                session_place(session, k, at, 0, SESSION_RANK_REPEAT) < 0)
+            return -1;
+    }
+    stats_stage(res, ZXCVBN_STAGE_REPEAT, &t);
+
+    k = res->candidates.n;
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_BREACH_M)) {
+        if (match_breach_hash(res, hash_mix(session->hashes[len - 1]), len) < 0 ||
+                session_place(session, k, 0, 0, SESSION_RANK_BREACH) < 0)
+            return -1;
+    }
+    stats_stage(res, ZXCVBN_STAGE_BREACH, &t);
+
+    return 0;
+}
+
+/*
+ * Where each user word is looked for again: past its last match that may end
+ * in the last chars of the first p ones. Candidates are still those of the
+ * previous scoring.
+ */
+static void
+session_word_starts(const struct zxcvbn_session *session, unsigned int p,
+                    unsigned int *starts)
+{
+    const struct zxcvbn_candidates *cands = &session->res.candidates;
+    unsigned int w, len, pos, k;
+
+    for (w = 0; w < session->words_num; ++w) {
+        len = strlen(session->words[w]);
+        starts[w] = p >= len ? p - len + 1 : 0;
+        for (pos = p; pos-- > 0 && pos + len >= p;) {
+            for (k = session->ends[pos]; k < cands->n && cands->j[k] == pos; ++k) {
+                if (session->ranks[k] == SESSION_RANK_WORDS + w)
+                    break;
+            }
+            if (k < cands->n && cands->j[k] == pos) {
+                starts[w] = pos + 1;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Dictionaries from p on and user words from their starts. Dictionary
+ * automatons resume in the states of the previous char.
+ */
+static int
+session_match_dicts(struct zxcvbn_session *session, const struct zxcvbn_dict_set *set,
+                    const unsigned int *starts, unsigned int p)
+{
+    struct zxcvbn_res *res = &session->res;
+    unsigned int len = session->password_len, w, word_len, k;
+
+    for (w = 0; w < session->words_num; ++w) {
+        word_len = strlen(session->words[w]);
+        if (!word_len || len < word_len)
+            continue;
+        k = res->candidates.n;
+        if (match_word(res, session->pack, starts[w], len,
+                       session->words[w], word_len) < 0 ||
+                session_place(session, k, 0, 0, SESSION_RANK_WORDS + w) < 0)
+            return -1;
+    }
+
+    k = res->candidates.n;
+    if (p < len && (match_dicts(res, set, session->pack, p, len,
+                                session->set_states, session->states) < 0 ||
+                    session_place(session, k, 0, 0, SESSION_RANK_DICT) < 0))
+        return -1;
+
+    return 0;
+}
+
+struct session_key {
+    uint32_t j;
+    uint32_t rank;
+    uint32_t k;
+};
+
+static int
+session_key_cmp(const void *a, const void *b)
+{
+    const struct session_key *x = a, *y = b;
+
+    if (x->j != y->j)
+        return x->j < y->j ? -1 : 1;
+    if (x->rank != y->rank)
+        return x->rank < y->rank ? -1 : 1;
+    return x->k < y->k ? -1 : x->k > y->k;
+}
+
+/*
+ * Sort the candidates from first on by end and rank as match_ex() orders
+ * them. Kept candidates come before the new ones and are in order already,
+ * so ties keep their place.
+ */
+static int
+session_sort(struct zxcvbn_session *session, unsigned int first)
+{
+    struct zxcvbn_res *res = &session->res;
+    struct zxcvbn_candidates *cands = &res->candidates, sorted;
+    uint64_t buf[64 * (ZXCVBN_CANDIDATE_SIZE + sizeof(struct session_key) +
+                       sizeof(uint32_t)) / sizeof(uint64_t) + 2];
+    unsigned int k, n = cands->n - first;
+    struct session_key *keys;
+    uint32_t *ranks;
+    char *block;
+
+    if (n < 2)
+        return 0;
+    block = scratch_get(res, SCRATCH_ORDER, buf, sizeof(buf),
+                        n * (ZXCVBN_CANDIDATE_SIZE + sizeof(*keys) + sizeof(*ranks)) +
+                        sizeof(uint64_t));
+    if (block == NULL)
+        return -1;
+    candidates_layout(&sorted, block, n);
+    // keys go after the candidates, aligned
+    keys = (struct session_key *) (block + ((n * ZXCVBN_CANDIDATE_SIZE + 7) & ~7));
+    ranks = (uint32_t *) (keys + n);
+
+    for (k = 0; k < n; ++k) {
+        keys[k].j = cands->j[first + k];
+        keys[k].rank = session->ranks[first + k];
+        keys[k].k = first + k;
+    }
+    qsort(keys, n, sizeof(*keys), session_key_cmp);
+
+    for (k = 0; k < n; ++k) {
+        candidate_copy(&sorted, k, cands, keys[k].k);
+        ranks[k] = keys[k].rank;
+    }
+    for (k = 0; k < n; ++k) {
+        candidate_copy(cands, first + k, &sorted, k);
+        session->ranks[first + k] = ranks[k];
+    }
+    scratch_put(res, block, buf);
+
+    return 0;
+}
+
+/*
+ * Match of res covering pos where the walk of the path stops, -1 if the path
+ * doesn't stop at pos.
+ */
+static int
+session_path_match(const struct zxcvbn_session *session, unsigned int pos)
+{
+    const struct zxcvbn_match *match;
+    int k = session->path_matches[pos];
+
+    if (k < 0 || k >= session->res.n_matches)
+        return -1;
+    match = session->res.matches + k;
+    if (match->i > pos || match->j < pos ||
+            (match->j != pos && match->type != ZXCVBN_MATCH_TYPE_BRUTEFORCE))
+        return -1;
+    return k;
+}
+
+/*
+ * The path of the password as min_entropy_path() finds it. Matches of the
+ * prefixes before from are kept, so once the walk back stops at a char the
+ * previous path stopped at too the rest of the previous path is kept.
+ */
+static int
+session_path(struct zxcvbn_session *session, const struct candidate_order *o,
+             unsigned int from, unsigned int bruteforce_card)
+{
+    struct zxcvbn_res *res = &session->res;
+    const struct zxcvbn_candidates *cands = &res->candidates;
+    const int *matches = session->path;
+    int i, k, end, match_i, path_buf[ZXCVBN_STACK_LEN], *path, path_len, keep;
+    struct zxcvbn_match *match, *old;
+    unsigned int pos, marked;
+
+    path = scratch_get(res, SCRATCH_PATH, path_buf, sizeof(path_buf),
+                       session->password_len * sizeof(*path));
+    if (path == NULL)
+        return -1;
+
+    keep = 0;
+    pos = 0;
+    for (i = session->password_len - 1, end = -1, path_len = 0; i >= 0;) {
+        if (i < from && (k = session_path_match(session, i)) >= 0) {
+            match = res->matches + k;
+            if (match->type == ZXCVBN_MATCH_TYPE_BRUTEFORCE) {
+                // the gap goes on to the new one
+                end = end < 0 ? i : end;
+                pos = match->i;
+                keep = k;
+            } else {
+                pos = i + 1;
+                keep = k + 1;
+            }
+            break;
+        }
+        if (matches[i] < 0) {
+            end = end < 0 ? i : end;
+            i--;
+        } else {
+            if (end >= 0) {
+                path[path_len++] = -1 - end;
+                end = -1;
+            }
+            match_i = o->order[matches[i]];
+            path[path_len++] = match_i;
+            i = cands->i[match_i] - 1;
+        }
+    }
+    if (end >= 0)
+        path[path_len++] = -1 - end;
+    marked = i + 1;
+
+    for (k = res->n_matches; k-- > keep;)
+        CIRCLEQ_REMOVE(&res->match_head, res->matches + k, list);
+    res->n_matches = keep;
+    old = res->matches;
+
+    for (; path_len-- > 0; pos = match->j + 1) {
+        if (path[path_len] < 0)
+            match = push_match_bruteforce(res, pos, -1 - path[path_len],
+                                          bruteforce_card);
+        else if ((match = match_add(res)) != NULL)
+            match_fill(match, cands, path[path_len]);
+        if (match == NULL)
+            break;
+        k = match->type == ZXCVBN_MATCH_TYPE_BRUTEFORCE ? MAX(match->i, marked) : match->j;
+        for (; k <= match->j; ++k)
+            session->path_matches[k] = match - res->matches;
+    }
+    scratch_put(res, path, path_buf);
+    if (path_len >= 0)
+        return -1;
+
+    // matches may have moved while being added, then all are linked again
+    if (res->matches != old) {
+        CIRCLEQ_INIT(&res->match_head);
+        keep = 0;
+    }
+    for (k = keep; k < res->n_matches; k++)
+        CIRCLEQ_INSERT_TAIL(&res->match_head, res->matches + k, list);
+
+    return 0;
+}
+
+/*
+ * Score the password of the session, its first p chars are those of the
+ * previous scoring and its chars from from on are new. Matchers look again
+ * where their last scan could go on differently, at most a match span back
+ * but for spatial walks on several layouts at once. Candidates ending before
+ * the first of those chars are kept, and so are the entropy of the prefixes
+ * before it and the path up to where the new one meets the previous one.
+ */
+static int
+session_score(struct zxcvbn_session *session, const struct zxcvbn_dict_set *set,
+              unsigned int p, unsigned int from)
+{
+    struct zxcvbn_res *res = &session->res;
+    struct zxcvbn *zxcvbn = res->zxcvbn;
+    struct zxcvbn_candidates *cands = &res->candidates;
+    unsigned int starts_buf[64], *starts, resume[SESSION_RANK_WORDS];
+    unsigned int len, pos, k, first, runs_from, bruteforce_card;
+    struct zxcvbn_analysis analysis;
+    struct candidate_order o;
+    uint64_t t;
+    int ret;
+
+    // matches of another dictionary set can't be kept
+    if (set != session->set ||
+            (set != NULL && set->generation != session->set_generation)) {
+        session->set = set;
+        session->set_generation = set != NULL ? set->generation : 0;
+        p = 0;
+    }
+
+    len = session->password_len;
+    if (len == 0) {
+        cands->n = 0;
+        res->n_matches = 0;
+        res->entropy = 0;
+        CIRCLEQ_INIT(&res->match_head);
+        session->bruteforce_card = 0;
+        return 0;
+    }
+
+    t = stats_clock(res);
+    session_analyze(session, from);
+    session_resume(session, p, resume);
+
+    // the first position whose candidates may change
+    first = p > 0 ? p - 1 : 0;
+    for (k = 0; k < SESSION_RANK_WORDS; ++k) {
+        if (k != SESSION_RANK_DATE && k != SESSION_RANK_BREACH)
+            first = MIN(first, resume[k]);
+    }
+    if (p == 0)
+        cands->n = 0;
+
+    starts = scratch_get(res, SCRATCH_WINDOW, starts_buf, sizeof(starts_buf),
+                         session->words_num * sizeof(*starts));
+    if (starts == NULL)
+        goto error;
+    session_word_starts(session, p, starts);
+    session_drop(session, p > 0 ? session->ends[first] : 0, p, resume);
+    k = cands->n;
+
+    runs_from = MIN(MIN(resume[SESSION_RANK_DIGITS], resume[SESSION_RANK_DATE]),
+                    MIN(resume[SESSION_RANK_DATE_SEP], resume[SESSION_RANK_REPEAT]));
+    runs_from = MIN(runs_from, len - 1);
+    ret = -1;
+    if (session_runs(session, &analysis, runs_from) < 0) {
+        scratch_put(res, starts, starts_buf);
+        goto error;
+    }
+    stats_stage(res, ZXCVBN_STAGE_ANALYZE, &t);
+
+    if (session_match_patterns(session, &analysis, runs_from, resume, p) < 0)
+        goto out;
+    t = stats_clock(res);
+    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_REPEAT_M) &&
+            session_match_dicts(session, set, starts, p) < 0)
+        goto out;
+    stats_stage(res, ZXCVBN_STAGE_DICT, &t);
+
+    analysis.classes = session->classes;
+    analysis.pack = session->pack;
+    analysis.uppers = session->uppers;
+    analysis.lowers = session->lowers;
+    analysis.utf8_chars = session->utf8_chars;
+    candidates_entropy(res, &analysis, session->password, k);
+    stats_stage(res, ZXCVBN_STAGE_ENTROPY, &t);
+
+    k = p > 0 ? session->ends[first] : 0;
+    if (session_reserve_ranks(session, cands->n) < 0 || session_sort(session, k) < 0)
+        goto out;
+    for (pos = first; pos < len; ++pos) {
+        while (k < cands->n && cands->j[k] < pos)
+            k++;
+        session->ends[pos] = k;
+    }
+    o.order = session->order;
+    o.ends = session->ends;
+    o.n_ordered = cands->n;
+
+    bruteforce_card = calc_bruteforce_card(session->masks[len - 1], zxcvbn->n_symbols);
+    if (bruteforce_card != session->bruteforce_card) {
+        session->bruteforce_card = bruteforce_card;
+        first = 0;
+    }
+    min_entropy_prefixes(res, &o, first, len, log2(bruteforce_card),
+                         session->pos_entropy, UINT_MAX, session->path);
+    res->entropy = session->pos_entropy[len - 1];
+
+    ret = session_path(session, &o, first, bruteforce_card);
+    stats_stage(res, ZXCVBN_STAGE_MIN_ENTROPY, &t);
+
+out:
+    analysis_release(res, &analysis);
+    scratch_put(res, starts, starts_buf);
+    if (ret == 0)
+        return 0;
+
+error:
+    session->password_len = 0;
+    session->bruteforce_card = 0;
+    cands->n = 0;
+    res->n_matches = 0;
+    res->entropy = 0;
+    CIRCLEQ_INIT(&res->match_head);
+    return -1;
+}
+
+int
+zxcvbn_session_append(struct zxcvbn_session *session, const char *str, unsigned int len)
+{
+    struct zxcvbn *zxcvbn = session->res.zxcvbn;
+    struct zxcvbn_dict_set *set;
+    unsigned int epoch, from;
+    int ret;
+
+    from = session->password_len;
+    if (len > UINT_MAX - from || session_reserve(session, from + len) < 0)
+        return -1;
+    memcpy(session->password + from, str, len);
+    session->password_len += len;
+
+    stats_begin(&session->res);
+    set = dict_set_pin(zxcvbn, &epoch);
+    ret = session_score(session, set, from, from);
+    dict_set_unpin(zxcvbn, epoch);
+    stats_end(&session->res);
+
+    return ret;
+}
+
+int
+zxcvbn_session_truncate(struct zxcvbn_session *session, unsigned int len)
+{
+    struct zxcvbn *zxcvbn = session->res.zxcvbn;
+    struct zxcvbn_dict_set *set;
+    unsigned int epoch;
+    int ret;
+
+    if (len > session->password_len)
+        return -1;
+    session->password_len = len;
+
+    stats_begin(&session->res);
+    set = dict_set_pin(zxcvbn, &epoch);
+    ret = session_score(session, set, len, len);
+    dict_set_unpin(zxcvbn, epoch);
+    stats_end(&session->res);
+
+    return ret;
+}
+
+void
+zxcvbn_session_release(struct zxcvbn_session *session)
+{
+    struct zxcvbn *zxcvbn = session->res.zxcvbn;
+
+    zxcvbn_res_release(&session->res);
+    if (session->n_ranks_reserved)
+        __free(zxcvbn, session->order);
+    if (session->password_reserved)
+        __free(zxcvbn, session->pos_entropy);
+    if (session->allocated)
+        __free(zxcvbn, session);
+}
+
+/* Session ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Dictionary trie ========================================================== */
+
+/*
+ * Nodes are allocated in blocks of 256, so all children of a node live in
+ * the block of its base. Free nodes of a block form a ring threaded through
+ * their base (next) and rank (prev) fields. Blocks are kept in three lists:
+ * open blocks have room for several children, closed blocks are only used
+ * for single children and full blocks have no free nodes at all.
+ */
+#define ZXCVBN_BLOCK_SIZE       256
+#define ZXCVBN_BLOCK_MAX_TRIAL  1
+
+enum {
+    ZXCVBN_BLOCK_OPEN,
+    ZXCVBN_BLOCK_CLOSED,
+    ZXCVBN_BLOCK_FULL,
+};
+
+struct zxcvbn_trie_block {
+    int prev;
+    int next;
+    int list;
+    int num;
+    int reject;
+    int trial;
+    int free_node;
+};
+
+static void
+trie_block_pop(struct zxcvbn_trie *trie, int block)
+{
+    struct zxcvbn_trie_block *blocks;
+    int *head;
+
+    blocks = trie->blocks;
+    head = &trie->block_heads[blocks[block].list];
+
+    if (blocks[block].next == block)
+        *head = -1;
+    else {
+        blocks[blocks[block].prev].next = blocks[block].next;
+        blocks[blocks[block].next].prev = blocks[block].prev;
+        if (*head == block)
+            *head = blocks[block].next;
+    }
+}
+
+static void
+trie_block_push(struct zxcvbn_trie *trie, int block, int list)
+{
+    struct zxcvbn_trie_block *blocks;
+    int *head;
+
+    blocks = trie->blocks;
+    head = &trie->block_heads[list];
+    blocks[block].list = list;
+
+    if (*head < 0) {
+        blocks[block].prev = block;
+        blocks[block].next = block;
+    } else {
+        blocks[block].prev = blocks[*head].prev;
+        blocks[block].next = *head;
+        blocks[blocks[*head].prev].next = block;
+        blocks[*head].prev = block;
+    }
+    *head = block;
+}
+
+static void
+trie_block_move(struct zxcvbn_trie *trie, int block, int list)
+{
+    trie_block_pop(trie, block);
+    trie_block_push(trie, block, list);
+}
+
+static void
+trie_free_node(struct zxcvbn_trie *trie, int node)
+{
+    struct zxcvbn_trie_block *block;
+    struct zxcvbn_node *nodes;
+    int free_node;
+
+    nodes = trie->nodes;
+    block = trie->blocks + node / ZXCVBN_BLOCK_SIZE;
+
+    nodes[node].check = ZXCVBN_NODE_FREE;
+
+    if (block->num++ == 0) {
+        nodes[node].base = node;
+        nodes[node].rank = node;
+        block->free_node = node;
+    } else {
+        free_node = block->free_node;
+        nodes[node].base = free_node;
+        nodes[node].rank = nodes[free_node].rank;
+        nodes[nodes[free_node].rank].base = node;
+        nodes[free_node].rank = node;
+    }
+
+    block->reject = ZXCVBN_BLOCK_SIZE + 1;
+    block->trial = 0;
+    if (block->num == 1)
+        trie_block_move(trie, block - trie->blocks, ZXCVBN_BLOCK_CLOSED);
+    else if (block->list == ZXCVBN_BLOCK_CLOSED)
+        trie_block_move(trie, block - trie->blocks, ZXCVBN_BLOCK_OPEN);
+}
+
+static void
+trie_use_node(struct zxcvbn_trie *trie, int node, int parent)
+{
+    struct zxcvbn_trie_block *block;
+    struct zxcvbn_node *nodes;
+    int next, prev;
+
+    nodes = trie->nodes;
+    block = trie->blocks + node / ZXCVBN_BLOCK_SIZE;
+    next = nodes[node].base;
+    prev = nodes[node].rank;
+
+    if (--block->num == 0)
+        trie_block_move(trie, block - trie->blocks, ZXCVBN_BLOCK_FULL);
+    else {
+        nodes[prev].base = next;
+        nodes[next].rank = prev;
+        if (block->free_node == node)
+            block->free_node = next;
+        if (block->num == 1 && block->list == ZXCVBN_BLOCK_OPEN)
+            trie_block_move(trie, block - trie->blocks, ZXCVBN_BLOCK_CLOSED);
+    }
+
+    nodes[node].base = 0;
+    nodes[node].check = parent;
+    nodes[node].rank = -1;
+}
+
+static int
+trie_add_block(struct zxcvbn *zxcvbn, struct zxcvbn_trie *trie)
+{
+    unsigned int i, n_blocks;
+    struct zxcvbn_trie_block *blocks;
+    struct zxcvbn_node *nodes;
+
+    n_blocks = trie->n_nodes / ZXCVBN_BLOCK_SIZE;
+
+    // grow both arrays geometrically, n_blocks is their power of two capacity
+    if ((n_blocks & (n_blocks - 1)) == 0) {
+        nodes = __realloc(zxcvbn, trie->nodes,
+                          (n_blocks ? n_blocks * 2 : 1) * ZXCVBN_BLOCK_SIZE * sizeof(*nodes));
+        if (nodes == NULL)
+            return -1;
+        trie->nodes = nodes;
+        blocks = __realloc(zxcvbn, trie->blocks,
+                           (n_blocks ? n_blocks * 2 : 1) * sizeof(*blocks));
+        if (blocks == NULL)
+            return -1;
+        trie->blocks = blocks;
+    }
+
+    trie->n_nodes += ZXCVBN_BLOCK_SIZE;
+    trie->blocks[n_blocks].num = 0;
+    trie_block_push(trie, n_blocks, ZXCVBN_BLOCK_FULL);
+    for (i = n_blocks * ZXCVBN_BLOCK_SIZE; i < trie->n_nodes; ++i)
+        trie_free_node(trie, i);
+
+    return n_blocks;
+}
+
+/*
+ * Find base such that base ^ codes[k] is free for every k, codes must be
+ * sorted. Zero base is reserved for nodes without children.
+ */
+static int
+trie_find_base(struct zxcvbn *zxcvbn, struct zxcvbn_trie *trie,
+               const unsigned char *codes, unsigned int n_codes)
+{
+    struct zxcvbn_trie_block *blocks;
+    unsigned int k;
+    int block, next, last, node, base;
+
+    if (n_codes == 1 && (block = trie->block_heads[ZXCVBN_BLOCK_CLOSED]) >= 0) {
+        if ((base = trie->blocks[block].free_node ^ codes[0]) != 0)
+            return base;
+    }
+
+    if ((block = trie->block_heads[ZXCVBN_BLOCK_OPEN]) >= 0) {
+        blocks = trie->blocks;
+        last = blocks[block].prev;
+        for (;; block = next) {
+            next = blocks[block].next;
+            if (blocks[block].num >= n_codes && n_codes < blocks[block].reject) {
+                node = blocks[block].free_node;
+                do {
+                    if ((base = node ^ codes[0]) != 0) {
+                        for (k = 1; k < n_codes; ++k) {
+                            if (trie->nodes[base ^ codes[k]].check != ZXCVBN_NODE_FREE)
+                                break;
+                        }
+                        if (k == n_codes)
+                            return base;
+                    }
+                    node = trie->nodes[node].base;
+                } while (node != blocks[block].free_node);
+
+                blocks[block].reject = n_codes;
+                if (++blocks[block].trial == ZXCVBN_BLOCK_MAX_TRIAL)
+                    trie_block_move(trie, block, ZXCVBN_BLOCK_CLOSED);
+            }
+            if (block == last)
+                break;
+        }
+    }
+
+    if ((block = trie_add_block(zxcvbn, trie)) < 0)
+        return -1;
+
+    return trie->blocks[block].free_node ^ codes[0];
+}
+
+// move the children of parent to a new base that also has room for code
+static int
+trie_relocate(struct zxcvbn *zxcvbn, struct zxcvbn_trie *trie, int parent, unsigned char code)
+{
+    unsigned char codes[ZXCVBN_BLOCK_SIZE] = {0};
+    unsigned int i, c, n_codes;
+    int base, old_base, old, new, child;
+    struct zxcvbn_node *nodes;
+
+    old_base = trie->nodes[parent].base;
+
+    for (c = 0, n_codes = 0; c < trie->n_codes; ++c) {
+        if (c == code || trie->nodes[old_base ^ c].check == parent)
+            codes[n_codes++] = c;
+    }
+
+    if ((base = trie_find_base(zxcvbn, trie, codes, n_codes)) < 0)
+        return -1;
+
+    nodes = trie->nodes;
+    for (i = 0; i < n_codes; ++i) {
+        if (codes[i] == code)
+            continue;
+        old = old_base ^ codes[i];
+        new = base ^ codes[i];
+
+        trie_use_node(trie, new, parent);
+        nodes[new].base = nodes[old].base;
+        nodes[new].rank = nodes[old].rank;
+        if (nodes[old].base) {
+            for (c = 0; c < trie->n_codes; ++c) {
+                child = nodes[old].base ^ c;
+                if (nodes[child].check == old)
+                    nodes[child].check = new;
+            }
+        }
+
+        trie_free_node(trie, old);
+    }
+
+    nodes[parent].base = base;
+    return 0;
+}
+
+static int
+trie_add_node(struct zxcvbn *zxcvbn, struct zxcvbn_trie *trie, int parent, unsigned char code)
+{
+    int base, node;
+
+    node = trie->nodes[parent].base ^ code;
+    if (trie->nodes[node].check == parent)
+        return node;
+
+    if (!trie->nodes[parent].base) {
+        if ((base = trie_find_base(zxcvbn, trie, &code, 1)) < 0)
+            return -1;
+        trie->nodes[parent].base = base;
+    } else if (trie->nodes[node].check != ZXCVBN_NODE_FREE) {
+        if (trie_relocate(zxcvbn, trie, parent, code) < 0)
+            return -1;
+    }
+
+    node = trie->nodes[parent].base ^ code;
+    trie_use_node(trie, node, parent);
+    return node;
+}
+
+static void
+trie_release(struct zxcvbn *zxcvbn, struct zxcvbn_trie *trie)
+{
+    __free(zxcvbn, trie->nodes);
+    __free(zxcvbn, trie->blocks);
+}
+
+static int
+trie_init(struct zxcvbn *zxcvbn, struct zxcvbn_trie *trie)
+{
+    unsigned int i;
+
+    trie->nodes = NULL;
+    trie->n_nodes = 0;
+    trie->blocks = NULL;
+    trie->block_heads[ZXCVBN_BLOCK_OPEN] = -1;
+    trie->block_heads[ZXCVBN_BLOCK_CLOSED] = -1;
+    trie->block_heads[ZXCVBN_BLOCK_FULL] = -1;
+
+    for (i = 0, trie->n_codes = 0; i < ARRAY_SIZE(zxcvbn->pack_table); ++i) {
+        if ((unsigned char) zxcvbn->pack_table[i] >= trie->n_codes)
+            trie->n_codes = (unsigned char) zxcvbn->pack_table[i] + 1;
+    }
+
+    if (trie_add_block(zxcvbn, trie) < 0) {
+        trie_release(zxcvbn, trie);
+        return -1;
+    }
+    trie_use_node(trie, 0, ZXCVBN_NODE_ROOT);
+
+    return 0;
+}
+
+/* Dictionary trie ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Dictionary automaton ===================================================== */
+
+struct zxcvbn_automaton_entry {
+    int state;
+    int dict;
+    int rank;
+};
+
+static void
+automaton_free(struct zxcvbn *zxcvbn, struct zxcvbn_automaton *automaton)
+{
+    trie_release(zxcvbn, &automaton->trie);
+    __free(zxcvbn, automaton->fail);
+    __free(zxcvbn, automaton->out_link);
+    __free(zxcvbn, automaton->depth);
+    __free(zxcvbn, automaton->outs);
+}
+
+static void
+automaton_release(struct zxcvbn *zxcvbn)
+{
+    // dictionaries change
+    cache_invalidate(zxcvbn);
+    if (zxcvbn->automaton == NULL)
+        return;
+
+    automaton_free(zxcvbn, zxcvbn->automaton);
+    __free(zxcvbn, zxcvbn->automaton);
+    zxcvbn->automaton = NULL;
+}
+
+static int
+automaton_entry_cmp(const void *a, const void *b)
+{
+    const struct zxcvbn_automaton_entry *x = a, *y = b;
+
+    if (x->state != y->state)
+        return x->state < y->state ? -1 : 1;
+    return x->dict - y->dict;
+}
+
+/*
+ * Copy the words of dict into the goto trie. Adding words relocates states,
+ * so outputs are collected by a second walk over the complete trie.
+ */
+static int
+automaton_add_dict(struct zxcvbn *zxcvbn, struct zxcvbn_automaton *automaton,
+                   struct zxcvbn_dict *dict, int dict_idx,
+                   struct zxcvbn_automaton_entry **entries,
+                   unsigned int *n_entries, unsigned int *n_entries_reserved)
+{
+    struct {
+        int node;
+        int state;
+        unsigned int code;
+    } stack_buf[ZXCVBN_STACK_LEN], *stack, *frame;
+    const struct zxcvbn_node *nodes;
+    struct zxcvbn_automaton_entry *entry;
+    int depth, node, state, ret;
+    unsigned int code, n_frames;
+
+    nodes = dict->trie.nodes;
+    stack = stack_buf;
+    n_frames = ARRAY_SIZE(stack_buf);
+    depth = 0;
+    stack[0].node = 0;
+    stack[0].state = 0;
+    stack[0].code = 0;
+    ret = -1;
+
+    while (depth >= 0) {
+        if ((code = stack[depth].code++) == dict->trie.n_codes) {
+            --depth;
+            continue;
+        }
+        node = nodes[stack[depth].node].base ^ code;
+        if (nodes[node].check != stack[depth].node)
+            continue;
+
+        if (entries == NULL) {
+            state = trie_add_node(zxcvbn, &automaton->trie, stack[depth].state, code);
+            if (state < 0)
+                goto out;
+        } else
+            state = automaton->trie.nodes[stack[depth].state].base ^ code;
+
+        if (entries != NULL && nodes[node].rank > 0) {
+            if (*n_entries == *n_entries_reserved) {
+                *n_entries_reserved = *n_entries_reserved ? *n_entries_reserved * 2 : 1024;
+                entry = __realloc(zxcvbn, *entries, *n_entries_reserved * sizeof(*entry));
+                if (entry == NULL)
+                    goto out;
+                *entries = entry;
+            }
+            entry = *entries + (*n_entries)++;
+            entry->state = state;
+            entry->dict = dict_idx;
+            entry->rank = nodes[node].rank;
+        }
+
+        // words are as long as they come, so the stack grows with them
+        if (++depth == n_frames) {
+            n_frames *= 2;
+            if (stack == stack_buf) {
+                if ((frame = __malloc(zxcvbn, n_frames * sizeof(*frame))) == NULL)
+                    goto out;
+                memcpy(frame, stack_buf, sizeof(stack_buf));
+            } else if ((frame = __realloc(zxcvbn, stack, n_frames * sizeof(*frame))) == NULL)
+                goto out;
+            stack = frame;
+        }
+        stack[depth].node = node;
+        stack[depth].state = state;
+        stack[depth].code = 0;
+    }
+    ret = 0;
+
+out:
+    if (stack != stack_buf)
+        __free(zxcvbn, stack);
+    return ret;
+}
+
+// outputs of every state, each list is terminated by an entry with dict -1
+static int
+automaton_make_outs(struct zxcvbn *zxcvbn, struct zxcvbn_automaton *automaton,
+                    struct zxcvbn_automaton_entry *entries, unsigned int n_entries)
+{
+    unsigned int i, n;
+    struct zxcvbn_node *nodes;
+
+    if (n_entries > 0)
+        qsort(entries, n_entries, sizeof(*entries), automaton_entry_cmp);
+
+    for (i = 0, n = n_entries; i < n_entries; ++i) {
+        if (i == 0 || entries[i].state != entries[i - 1].state)
+            ++n;
+    }
+
+    if ((automaton->outs = __malloc(zxcvbn, n * sizeof(*automaton->outs))) == NULL)
+        return -1;
+
+    nodes = automaton->trie.nodes;
+    for (i = 0, n = 0; i < n_entries; ++i) {
+        if (i > 0 && entries[i].state != entries[i - 1].state)
+            automaton->outs[n++].dict = -1;
+        if (nodes[entries[i].state].rank < 0)
+            nodes[entries[i].state].rank = n;
+        automaton->outs[n].dict = entries[i].dict;
+        automaton->outs[n].rank = entries[i].rank;
+        ++n;
+    }
+    if (n_entries > 0)
+        automaton->outs[n++].dict = -1;
+    automaton->n_outs = n;
+
+    return 0;
+}
+
+// breadth-first pass computing failure and output links
+static int
+automaton_make_links(struct zxcvbn *zxcvbn, struct zxcvbn_automaton *automaton)
+{
+    unsigned int head, tail, code;
+    int state, next, fail, *queue;
+    struct zxcvbn_node *nodes;
+    size_t size;
+
+    size = automaton->trie.n_nodes * sizeof(int);
+    if ((automaton->fail = __malloc(zxcvbn, size)) == NULL ||
+            (automaton->out_link = __malloc(zxcvbn, size)) == NULL ||
+            (automaton->depth = __malloc(zxcvbn, size)) == NULL ||
+            (queue = __malloc(zxcvbn, size)) == NULL)
+        return -1;
+
+    nodes = automaton->trie.nodes;
+    automaton->fail[0] = 0;
+    automaton->out_link[0] = 0;
+    automaton->depth[0] = 0;
+    head = tail = 0;
+    queue[tail++] = 0;
+
+    while (head < tail) {
+        state = queue[head++];
+        for (code = 0; code < automaton->trie.n_codes; ++code) {
+            next = nodes[state].base ^ code;
+            if (nodes[next].check != state)
+                continue;
+
+            fail = 0;
+            if (state != 0) {
+                for (fail = automaton->fail[state];; fail = automaton->fail[fail]) {
+                    if (nodes[nodes[fail].base ^ code].check == fail) {
+                        fail = nodes[fail].base ^ code;
+                        break;
+                    }
+                    if (fail == 0)
+                        break;
+                }
             }
+
+            automaton->fail[next] = fail;
+            automaton->out_link[next] = nodes[fail].rank >= 0 ? fail : automaton->out_link[fail];
+            automaton->depth[next] = automaton->depth[state] + 1;
+            queue[tail++] = next;
+        }
+    }
+
+    __free(zxcvbn, queue);
+    return 0;
+}
+
+int
+zxcvbn_dict_compile(struct zxcvbn *zxcvbn)
+{
+    struct zxcvbn_automaton *automaton;
+    struct zxcvbn_automaton_entry *entries;
+    unsigned int n_entries, n_entries_reserved;
+    struct zxcvbn_dict *dict;
+    int dict_idx;
+
+    automaton_release(zxcvbn);
+
+    if ((automaton = __malloc(zxcvbn, sizeof(*automaton))) == NULL)
+        return -1;
+    memset(automaton, 0, sizeof(*automaton));
+
+    if (trie_init(zxcvbn, &automaton->trie) < 0) {
+        __free(zxcvbn, automaton);
+        return -1;
+    }
+    zxcvbn->automaton = automaton;
+
+    entries = NULL;
+    n_entries = n_entries_reserved = 0;
+    dict_idx = 0;
+
+    LIST_FOREACH(dict, &zxcvbn->dict_head, list) {
+        if (automaton_add_dict(zxcvbn, automaton, dict, 0, NULL, NULL, NULL) < 0)
+            goto err;
+    }
+
+    // dictionaries are numbered in match_dict() order
+    LIST_FOREACH(dict, &zxcvbn->dict_head, list) {
+        if (automaton_add_dict(zxcvbn, automaton, dict, dict_idx++,
+                               &entries, &n_entries, &n_entries_reserved) < 0)
+            goto err;
+    }
+
+    if (automaton_make_outs(zxcvbn, automaton, entries, n_entries) < 0 ||
+            automaton_make_links(zxcvbn, automaton) < 0)
+        goto err;
+
+    // the goto trie is complete, drop the state used to extend it
+    __free(zxcvbn, automaton->trie.blocks);
+    automaton->trie.blocks = NULL;
+    __free(zxcvbn, entries);
+    return 0;
+
+err:
+    __free(zxcvbn, entries);
+    automaton_release(zxcvbn);
+    return -1;
+}
+
+/* Dictionary automaton ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+static void
+zxcvbn_dict_release(struct zxcvbn_dict *dict)
+{
+    automaton_release(dict->zxcvbn);
+
+    LIST_REMOVE(dict, list);
+
+    if (dict->map != NULL)
+        munmap(dict->map, dict->map_size);
+    else
+        trie_release(dict->zxcvbn, &dict->trie);
+
+    if (dict->allocated)
+        __free(dict->zxcvbn, dict);
+}
+
+void
+zxcvbn_release(struct zxcvbn *zxcvbn)
+{
+    struct zxcvbn_dict *dict;
+    unsigned int i;
+
+    if (zxcvbn == NULL)
+        return;
+
+    while (!LIST_EMPTY(&zxcvbn->dict_head)) {
+        dict = LIST_FIRST(&zxcvbn->dict_head);
+        zxcvbn_dict_release(dict);
+    }
+    automaton_release(zxcvbn);
+    zxcvbn_dict_set_detach(zxcvbn);
+
+    for (i = 0; i < zxcvbn->n_layouts; ++i) {
+        if (zxcvbn->allocated_layouts & ((uint32_t) 1 << i))
+            __free(zxcvbn, (void *) zxcvbn->layouts[i]);
+    }
+
+    for (i = ARRAY_SIZE(builtin_sequences); i < zxcvbn->n_sequences; ++i)
+        __free(zxcvbn, (void *) zxcvbn->sequences[i]);
+    if (zxcvbn->sequence_masks != sequence_masks)
+        __free(zxcvbn, (void *) zxcvbn->sequence_masks);
+    if (zxcvbn->cache != NULL)
+        __free(zxcvbn, zxcvbn->cache);
+    zxcvbn_breach_release(zxcvbn->breach);
+    if (zxcvbn->stats_block != NULL)
+        __free(zxcvbn, zxcvbn->stats_block);
+
+    if (zxcvbn->allocated)
+        __free(zxcvbn, zxcvbn);
+}
+
+static struct zxcvbn_dict *
+dict_alloc(struct zxcvbn *zxcvbn, struct zxcvbn_dict *dict_buf, const char *name)
+{
+    struct zxcvbn_dict *dict;
+
+    if (dict_buf != NULL) {
+        dict = dict_buf;
+        dict->allocated = 0;
+    } else {
+        if ((dict = __malloc(zxcvbn, sizeof(struct zxcvbn_dict))) == NULL)
+            return NULL;
+        dict->allocated = 1;
+    }
+        
+    dict->zxcvbn = zxcvbn;
+    strncpy(dict->name, name, sizeof(dict->name));
+    dict->name[sizeof(dict->name) - 1] = '\0';
+    dict->map = NULL;
+    dict->map_size = 0;
+
+    return dict;
+}
+
+struct zxcvbn_dict *
+zxcvbn_dict_init(struct zxcvbn *zxcvbn, struct zxcvbn_dict *dict_buf, const char *name)
+{
+    struct zxcvbn_dict *dict;
+
+    if ((dict = dict_alloc(zxcvbn, dict_buf, name)) == NULL)
+        return NULL;
+
+    if (trie_init(zxcvbn, &dict->trie) < 0) {
+        if (dict->allocated)
+            __free(zxcvbn, dict);
+        return NULL;
+    }
+
+    automaton_release(zxcvbn);
+    LIST_INSERT_HEAD(&zxcvbn->dict_head, dict, list);
+
+    return dict;
+}
+
+int
+zxcvbn_dict_add_word(struct zxcvbn_dict *dict, const char *word, unsigned int word_len, unsigned int rank)
+{
+    int i, node, parent;
+    struct zxcvbn_node *nodes;
+
+    if (dict->map != NULL)
+        return -1;
+
+    if (pow(26, word_len) < rank) {
+        // bruteforce possibilities are less then word rank.
+        return 0;
+    }
+
+    automaton_release(dict->zxcvbn);
+
+    parent = 0;
+
+    for (i = 0;; ++i) {
+        node = trie_add_node(dict->zxcvbn, &dict->trie, parent,
+                             pack_char(dict->zxcvbn, word[i]));
+        if (node < 0)
+            return -1;
+
+        if (i == word_len - 1) {
+            nodes = dict->trie.nodes;
+            if (nodes[node].rank == -1 || nodes[node].rank > rank)
+                nodes[node].rank = rank;
+            break;
+        }
+
+        parent = node;
+    }
+
+    return 1;
+}
+
+/* Dictionary image ========================================================= */
+
+#define ZXCVBN_DICT_IMAGE_MAGIC     "ZXCVBND"
+#define ZXCVBN_DICT_IMAGE_VERSION   1
+#define ZXCVBN_DICT_IMAGE_ORDER     0x01020304
+
+/*
+ * The image is the header followed by the n_nodes nodes of the trie. It has
+ * no pointers, so it is used in place wherever it is mapped. Integers are in
+ * the byte order of the host that saved it.
+ */
+struct zxcvbn_dict_image {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_size;
+    uint32_t n_nodes;
+    uint32_t n_codes;
+    char pack_table[256];
+};
+
+int
+zxcvbn_dict_save(struct zxcvbn_dict *dict, const char *path)
+{
+    struct zxcvbn_dict_image image;
+    struct zxcvbn_node node;
+    char tmp_path[PATH_MAX];
+    unsigned int i;
+    FILE *file;
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path))
+        return -1;
+
+    memset(&image, 0, sizeof(image));
+    memcpy(image.magic, ZXCVBN_DICT_IMAGE_MAGIC, sizeof(ZXCVBN_DICT_IMAGE_MAGIC));
+    image.version = ZXCVBN_DICT_IMAGE_VERSION;
+    image.byte_order = ZXCVBN_DICT_IMAGE_ORDER;
+    image.node_size = sizeof(struct zxcvbn_node);
+    image.n_nodes = dict->trie.n_nodes;
+    image.n_codes = dict->trie.n_codes;
+    memcpy(image.pack_table, dict->zxcvbn->pack_table, sizeof(image.pack_table));
+
+    if ((file = fopen(tmp_path, "w")) == NULL)
+        return -1;
+
+    if (fwrite(&image, sizeof(image), 1, file) != 1)
+        goto err;
+
+    for (i = 0; i < dict->trie.n_nodes; ++i) {
+        node = dict->trie.nodes[i];
+        // free nodes link the free ring of their block, blank them
+        if (node.check == ZXCVBN_NODE_FREE) {
+            node.base = 0;
+            node.rank = -1;
         }
+        if (fwrite(&node, sizeof(node), 1, file) != 1)
+            goto err;
+    }
+
+    if (fclose(file) != 0) {
+        unlink(tmp_path);
+        return -1;
     }
 
-    res->entropy = pos_entropy[password_len - 1];
+    // processes that have mapped the old image keep using it
+    if (rename(tmp_path, path) < 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+
+err:
+    fclose(file);
+    unlink(tmp_path);
+    return -1;
+}
+
+/*
+ * Walks read nodes[base ^ c] with c below n_codes and nodes[check], so an
+ * image is only used if these stay in its nodes. A node is reached only
+ * through its check, which the root has none of, so walks can't loop.
+ */
+static int
+dict_image_check_nodes(const struct zxcvbn_dict_image *image)
+{
+    const struct zxcvbn_node *nodes = (const struct zxcvbn_node *) (image + 1);
+    unsigned int i;
+
+    if (image->n_codes > ZXCVBN_BLOCK_SIZE || nodes[0].check != ZXCVBN_NODE_ROOT)
+        return -1;
+
+    for (i = 0; i < image->n_nodes; ++i) {
+        if (nodes[i].base < 0 || nodes[i].base >= image->n_nodes ||
+                nodes[i].check < ZXCVBN_NODE_ROOT || nodes[i].check >= (int) image->n_nodes)
+            return -1;
+    }
+    return 0;
+}
+
+struct zxcvbn_dict *
+zxcvbn_dict_load_mmap(struct zxcvbn *zxcvbn, struct zxcvbn_dict *dict_buf,
+                      const char *name, const char *path)
+{
+    struct zxcvbn_dict_image *image;
+    struct zxcvbn_dict *dict;
+    struct stat st;
+    void *map;
+    int fd;
 
-    for (i = password_len - 1, end = -1, min_matches_num = 0; i >= 0;) {
-        if (matches[i] < 0) {
-            end = end < 0 ? i : end;
-            i--;
-        } else {
-            if (end >= 0) {
-                min_matches[min_matches_num++] = res->n_matches;
-                if (!push_match_bruteforce(res, i + 1, end, bruteforce_card))
-                    return -1;
-                end = -1;
-            }
-            min_matches[min_matches_num++] = matches[i];
-            i = res->matches[matches[i]].i - 1;
-        }
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(*image)) {
+        close(fd);
+        return NULL;
     }
-    if (end >= 0) {
-        min_matches[min_matches_num++] = res->n_matches;
-        if (!push_match_bruteforce(res, 0, end, bruteforce_card))
-            return -1;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    image = map;
+    if (memcmp(image->magic, ZXCVBN_DICT_IMAGE_MAGIC, sizeof(ZXCVBN_DICT_IMAGE_MAGIC)) != 0 ||
+            image->version != ZXCVBN_DICT_IMAGE_VERSION ||
+            image->byte_order != ZXCVBN_DICT_IMAGE_ORDER ||
+            image->node_size != sizeof(struct zxcvbn_node) ||
+            image->n_nodes == 0 || image->n_nodes % ZXCVBN_BLOCK_SIZE != 0 ||
+            st.st_size != sizeof(*image) + (size_t) image->n_nodes * sizeof(struct zxcvbn_node) ||
+            memcmp(image->pack_table, zxcvbn->pack_table, sizeof(image->pack_table)) != 0 ||
+            dict_image_check_nodes(image) < 0)
+        goto err;
+
+    if ((dict = dict_alloc(zxcvbn, dict_buf, name)) == NULL)
+        goto err;
+
+    dict->map = map;
+    dict->map_size = st.st_size;
+    dict->trie.nodes = (struct zxcvbn_node *) (image + 1);
+    dict->trie.n_nodes = image->n_nodes;
+    dict->trie.n_codes = image->n_codes;
+    dict->trie.blocks = NULL;
+    dict->trie.block_heads[ZXCVBN_BLOCK_OPEN] = -1;
+    dict->trie.block_heads[ZXCVBN_BLOCK_CLOSED] = -1;
+    dict->trie.block_heads[ZXCVBN_BLOCK_FULL] = -1;
+
+    automaton_release(zxcvbn);
+    LIST_INSERT_HEAD(&zxcvbn->dict_head, dict, list);
+
+    return dict;
+
+err:
+    munmap(map, st.st_size);
+    return NULL;
+}
+
+/* Dictionary image ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Dictionary set =========================================================== */
+
+#define ZXCVBN_DICT_SET_MAGIC   "ZXCVBNS"
+#define ZXCVBN_DICT_SET_VERSION 1
+
+/*
+ * Generation g of set "name" lives in segment "/name.g", segment "/name"
+ * holds the number of the newest generation. The set image is the header
+ * followed by the goto trie nodes, fail, out_link and depth of every state
+ * and the outputs.
+ */
+struct zxcvbn_dict_set_image {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t generation;
+    uint32_t node_size;
+    uint32_t n_nodes;
+    uint32_t n_codes;
+    uint32_t n_outs;
+    char pack_table[256];
+};
+
+static int
+dict_set_shm_name(char *buf, size_t size, const char *name, uint64_t generation)
+{
+    int n;
+
+    if (generation == 0)
+        n = snprintf(buf, size, "/%s", name);
+    else
+        n = snprintf(buf, size, "/%s.%llu", name, (unsigned long long) generation);
+
+    return (n < 0 || n >= size) ? -1 : 0;
+}
+
+static size_t
+dict_set_size(uint32_t n_nodes, uint32_t n_outs)
+{
+    return sizeof(struct zxcvbn_dict_set_image) +
+           (size_t) n_nodes * (sizeof(struct zxcvbn_node) + 3 * sizeof(int)) +
+           (size_t) n_outs * sizeof(struct zxcvbn_automaton_out);
+}
+
+static uint64_t *
+dict_set_map_control(const char *name, int writable)
+{
+    char shm_name[NAME_MAX];
+    uint64_t *control;
+    int fd;
+
+    if (dict_set_shm_name(shm_name, sizeof(shm_name), name, 0) < 0)
+        return NULL;
+
+    if (writable)
+        fd = shm_open(shm_name, O_RDWR | O_CREAT, 0644);
+    else
+        fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    // a new segment is zero filled, so it starts at generation 0
+    if (writable && ftruncate(fd, sizeof(*control)) < 0) {
+        close(fd);
+        return NULL;
     }
 
-    CIRCLEQ_INIT(&res->match_head);
-    for (i = 0; i < min_matches_num; i++) {
-        match = res->matches + min_matches[i];
-        CIRCLEQ_INSERT_HEAD(&res->match_head, match, list);
+    control = mmap(NULL, sizeof(*control), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+
+    return control == MAP_FAILED ? NULL : control;
+}
+
+static void
+dict_set_release(struct zxcvbn *zxcvbn, struct zxcvbn_dict_set *set)
+{
+    if (set->control != NULL)
+        munmap(set->control, sizeof(*set->control));
+    if (set->map != NULL)
+        munmap(set->map, set->map_size);
+    else
+        automaton_free(zxcvbn, &set->automaton);
+    __free(zxcvbn, set);
+}
+
+// make set current and release the previous one once no reader holds it
+static void
+dict_set_replace(struct zxcvbn *zxcvbn, struct zxcvbn_dict_set *set)
+{
+    struct zxcvbn_dict_set *old;
+    unsigned int i, epoch;
+
+    old = __atomic_exchange_n(&zxcvbn->dict_set, set, __ATOMIC_SEQ_CST);
+    // a match reading the new generation pins the new set
+    cache_invalidate(zxcvbn);
+    if (old == NULL)
+        return;
+
+    for (i = 0; i < 2; ++i) {
+        epoch = __atomic_fetch_add(&zxcvbn->dict_set_epoch, 1, __ATOMIC_SEQ_CST) & 1;
+        while (__atomic_load_n(&zxcvbn->dict_set_readers[epoch], __ATOMIC_SEQ_CST) != 0)
+            sched_yield();
     }
 
-    return 0;
+    dict_set_release(zxcvbn, old);
 }
 
-int
-zxcvbn_match_ex(struct zxcvbn_res *res,
-                const char *password,      unsigned int password_len,
-                char **words,              unsigned int words_num,
-                struct zxcvbn_date *dates, unsigned int dates_num)
+// map the newest generation
+static struct zxcvbn_dict_set *
+dict_set_open(struct zxcvbn *zxcvbn, const char *name, uint64_t *control)
 {
-    int i;
-    struct zxcvbn *zxcvbn = res->zxcvbn;
-    struct zxcvbn_match *match;
+    char shm_name[NAME_MAX];
+    struct zxcvbn_dict_set_image *image;
+    struct zxcvbn_dict_set *set;
+    uint64_t generation;
+    struct stat st;
+    void *map;
+    char *p;
+    int fd;
 
-    assert(password_len > 0);
-    assert(password_len <= ZXCVBN_PASSWORD_LEN_MAX);
+    for (;;) {
+        if ((generation = __atomic_load_n(control, __ATOMIC_ACQUIRE)) == 0)
+            return NULL;
+        if (dict_set_shm_name(shm_name, sizeof(shm_name), name, generation) < 0)
+            return NULL;
+        if ((fd = shm_open(shm_name, O_RDONLY, 0)) >= 0)
+            break;
+        // the generation was replaced and unlinked after we read it
+        if (errno != ENOENT || __atomic_load_n(control, __ATOMIC_ACQUIRE) == generation)
+            return NULL;
+    }
 
-    if (!dates)
-        dates_num = 0;
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(*image)) {
+        close(fd);
+        return NULL;
+    }
 
-    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_SPATIAL_M)
-            && match_spatial(res, password, password_len))
-        return -1;
-    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_DIGITS_M)
-            && match_digits(res, password, password_len))
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    image = map;
+    if (memcmp(image->magic, ZXCVBN_DICT_SET_MAGIC, sizeof(ZXCVBN_DICT_SET_MAGIC)) != 0 ||
+            image->version != ZXCVBN_DICT_SET_VERSION ||
+            image->byte_order != ZXCVBN_DICT_IMAGE_ORDER ||
+            image->generation != generation ||
+            image->node_size != sizeof(struct zxcvbn_node) ||
+            st.st_size != dict_set_size(image->n_nodes, image->n_outs) ||
+            memcmp(image->pack_table, zxcvbn->pack_table, sizeof(image->pack_table)) != 0)
+        goto err;
+
+    if ((set = __malloc(zxcvbn, sizeof(*set))) == NULL)
+        goto err;
+    memset(set, 0, sizeof(*set));
+
+    strncpy(set->name, name, sizeof(set->name));
+    set->name[sizeof(set->name) - 1] = '\0';
+    set->control = control;
+    set->generation = generation;
+    set->map = map;
+    set->map_size = st.st_size;
+
+    p = (char *) (image + 1);
+    set->automaton.trie.nodes = (struct zxcvbn_node *) p;
+    set->automaton.trie.n_nodes = image->n_nodes;
+    set->automaton.trie.n_codes = image->n_codes;
+    set->automaton.trie.block_heads[ZXCVBN_BLOCK_OPEN] = -1;
+    set->automaton.trie.block_heads[ZXCVBN_BLOCK_CLOSED] = -1;
+    set->automaton.trie.block_heads[ZXCVBN_BLOCK_FULL] = -1;
+    p += image->n_nodes * sizeof(struct zxcvbn_node);
+    set->automaton.fail = (int *) p;
+    p += image->n_nodes * sizeof(int);
+    set->automaton.out_link = (int *) p;
+    p += image->n_nodes * sizeof(int);
+    set->automaton.depth = (int *) p;
+    p += image->n_nodes * sizeof(int);
+    set->automaton.outs = (struct zxcvbn_automaton_out *) p;
+    set->automaton.n_outs = image->n_outs;
+
+    return set;
+
+err:
+    munmap(map, st.st_size);
+    return NULL;
+}
+
+int
+zxcvbn_dict_set_publish(struct zxcvbn *zxcvbn, const char *name)
+{
+    char shm_name[NAME_MAX];
+    struct zxcvbn_dict_set_image *image;
+    struct zxcvbn_automaton *automaton;
+    uint64_t *control, generation;
+    size_t size;
+    void *map;
+    char *p;
+    int fd;
+
+    if (zxcvbn->automaton == NULL && zxcvbn_dict_compile(zxcvbn) < 0)
         return -1;
-    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_DATE_M)
-            && zxcvbn_date_match(res, (char *) password, password_len,
-                                 dates, dates_num))
+    automaton = zxcvbn->automaton;
+
+    if ((control = dict_set_map_control(name, 1)) == NULL)
         return -1;
-    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_SEQUENCE_M)
-            && zxcvbn_sequence_match(res, (char *) password, password_len))
+
+    generation = __atomic_load_n(control, __ATOMIC_ACQUIRE) + 1;
+    size = dict_set_size(automaton->trie.n_nodes, automaton->n_outs);
+
+    if (dict_set_shm_name(shm_name, sizeof(shm_name), name, generation) < 0 ||
+            (fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0) {
+        munmap(control, sizeof(*control));
         return -1;
-    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_REPEAT_M)
-            && zxcvbn_repeat_match(res, (char *) password, password_len))
+    }
+
+    if (ftruncate(fd, size) < 0 ||
+            (map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        shm_unlink(shm_name);
+        munmap(control, sizeof(*control));
         return -1;
-    if (!(zxcvbn->skipped_match_types & ZXCVBN_MATCH_TYPE_REPEAT_M)
-            && match_dict(res, password, password_len, words, words_num))
+    }
+    close(fd);
+
+    image = map;
+    memcpy(image->magic, ZXCVBN_DICT_SET_MAGIC, sizeof(ZXCVBN_DICT_SET_MAGIC));
+    image->version = ZXCVBN_DICT_SET_VERSION;
+    image->byte_order = ZXCVBN_DICT_IMAGE_ORDER;
+    image->generation = generation;
+    image->node_size = sizeof(struct zxcvbn_node);
+    image->n_nodes = automaton->trie.n_nodes;
+    image->n_codes = automaton->trie.n_codes;
+    image->n_outs = automaton->n_outs;
+    memcpy(image->pack_table, zxcvbn->pack_table, sizeof(image->pack_table));
+
+    p = (char *) (image + 1);
+    memcpy(p, automaton->trie.nodes, image->n_nodes * sizeof(struct zxcvbn_node));
+    p += image->n_nodes * sizeof(struct zxcvbn_node);
+    memcpy(p, automaton->fail, image->n_nodes * sizeof(int));
+    p += image->n_nodes * sizeof(int);
+    memcpy(p, automaton->out_link, image->n_nodes * sizeof(int));
+    p += image->n_nodes * sizeof(int);
+    memcpy(p, automaton->depth, image->n_nodes * sizeof(int));
+    p += image->n_nodes * sizeof(int);
+    memcpy(p, automaton->outs, image->n_outs * sizeof(struct zxcvbn_automaton_out));
+
+    munmap(map, size);
+
+    // the previous generation is freed once its last process switches over
+    __atomic_store_n(control, generation, __ATOMIC_RELEASE);
+    if (generation > 1 && dict_set_shm_name(shm_name, sizeof(shm_name), name, generation - 1) == 0)
+        shm_unlink(shm_name);
+
+    munmap(control, sizeof(*control));
+    return 0;
+}
+
+int
+zxcvbn_dict_set_attach(struct zxcvbn *zxcvbn, const char *name)
+{
+    struct zxcvbn_dict_set *set;
+    uint64_t *control;
+
+    if ((control = dict_set_map_control(name, 0)) == NULL)
         return -1;
 
-    for (i = 0; i < res->n_matches; ++i) {
-        match = res->matches + i;
-        switch (match->type) {
-        case ZXCVBN_MATCH_TYPE_DICT:
-            entropy_dict(zxcvbn, match, password, password_len);
-            break;        
-        case ZXCVBN_MATCH_TYPE_SPATIAL:
-            entropy_spatial(zxcvbn, match);
-            break;
-        case ZXCVBN_MATCH_TYPE_DIGITS:
-            entropy_digits(zxcvbn, match);
-            break;
-        case ZXCVBN_MATCH_TYPE_SEQUENCE:
-            zxcvbn_sequence_calculate_entropy(zxcvbn, match,
-                                              (char *) password, password_len);
-            break;
-        case ZXCVBN_MATCH_TYPE_REPEAT:
-            zxcvbn_repeat_calculate_entropy(zxcvbn, match,
-                                            (char *) password, password_len);
-            break;
-        case ZXCVBN_MATCH_TYPE_DATE:
-            zxcvbn_date_calculate_entropy(zxcvbn, match);
-            break;
-        default:
-            assert(0);
-        }
+    if ((set = dict_set_open(zxcvbn, name, control)) == NULL) {
+        munmap(control, sizeof(*control));
+        return -1;
     }
 
-    return min_entropy(res, password, password_len);
+    dict_set_replace(zxcvbn, set);
+
+    return 0;
 }
 
 int
-zxcvbn_match(struct zxcvbn_res *res,
-             const char *password, unsigned int password_len,
-             char **words,         unsigned int words_num)
+zxcvbn_dict_set_refresh(struct zxcvbn *zxcvbn)
 {
-    return zxcvbn_match_ex(res, password, password_len, words, words_num,
-                           NULL, 0);
+    struct zxcvbn_dict_set *set, *old;
+
+    if ((old = zxcvbn->dict_set) == NULL || old->control == NULL)
+        return -1;
+
+    if (__atomic_load_n(old->control, __ATOMIC_ACQUIRE) == old->generation)
+        return 0;
+
+    if ((set = dict_set_open(zxcvbn, old->name, old->control)) == NULL)
+        return -1;
+
+    // the control segment now belongs to the new generation, readers
+    // never look at it
+    old->control = NULL;
+    dict_set_replace(zxcvbn, set);
+
+    return 1;
 }
 
-static void
-free_node(struct zxcvbn *zxcvbn, struct zxcvbn_node *node)
+int
+zxcvbn_dict_set_install(struct zxcvbn *zxcvbn, struct zxcvbn *src)
 {
-    int i;
-    struct zxcvbn_node *child;
+    struct zxcvbn_dict_set *set;
 
-    for (i = 0; i < zxcvbn->pack_table_size; ++i) {
-        if ((child = node->children[i]) != NULL)
-            free_node(zxcvbn, child);
-    }
+    if (memcmp(zxcvbn->pack_table, src->pack_table, sizeof(zxcvbn->pack_table)) != 0 ||
+            zxcvbn->zxcvbn_free != src->zxcvbn_free)
+        return -1;
+
+    if (src->automaton == NULL && zxcvbn_dict_compile(src) < 0)
+        return -1;
+
+    if ((set = __malloc(zxcvbn, sizeof(*set))) == NULL)
+        return -1;
+    memset(set, 0, sizeof(*set));
+
+    set->generation = zxcvbn_dict_set_generation(zxcvbn) + 1;
+    set->automaton = *src->automaton;
+    __free(src, src->automaton);
+    src->automaton = NULL;
 
-    __free(zxcvbn, node);
+    dict_set_replace(zxcvbn, set);
+
+    return 0;
 }
 
-static void
-zxcvbn_dict_release(struct zxcvbn_dict *dict)
+uint64_t
+zxcvbn_dict_set_generation(struct zxcvbn *zxcvbn)
 {
-    LIST_REMOVE(dict, list);
+    struct zxcvbn_dict_set *set;
+    unsigned int epoch;
+    uint64_t generation;
 
-    free_node(dict->zxcvbn, dict->root);
+    set = dict_set_pin(zxcvbn, &epoch);
+    generation = set != NULL ? set->generation : 0;
+    dict_set_unpin(zxcvbn, epoch);
 
-    if (dict->allocated)
-        __free(dict->zxcvbn, dict);
+    return generation;
 }
 
 void
-zxcvbn_release(struct zxcvbn *zxcvbn)
+zxcvbn_dict_set_detach(struct zxcvbn *zxcvbn)
 {
-    struct zxcvbn_dict *dict;
+    dict_set_replace(zxcvbn, NULL);
+}
 
-    if (zxcvbn == NULL)
-        return;
+int
+zxcvbn_dict_set_unlink(const char *name)
+{
+    char shm_name[NAME_MAX];
+    uint64_t *control, generation;
 
-    while (!LIST_EMPTY(&zxcvbn->dict_head)) {
-        dict = LIST_FIRST(&zxcvbn->dict_head);
-        zxcvbn_dict_release(dict);
-    }
+    if ((control = dict_set_map_control(name, 0)) == NULL)
+        return -1;
 
-    if (zxcvbn->allocated)
-        __free(zxcvbn, zxcvbn);
+    generation = __atomic_load_n(control, __ATOMIC_ACQUIRE);
+    munmap(control, sizeof(*control));
+
+    if (generation > 0 && dict_set_shm_name(shm_name, sizeof(shm_name), name, generation) == 0)
+        shm_unlink(shm_name);
+
+    if (dict_set_shm_name(shm_name, sizeof(shm_name), name, 0) < 0)
+        return -1;
+
+    return shm_unlink(shm_name);
 }
 
-static struct zxcvbn_node *
-make_node(struct zxcvbn *zxcvbn)
-{
-    unsigned int size;
-    char *memory;
-    struct zxcvbn_node *node;
+/* Dictionary set ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
 
-    size = sizeof(*node) + zxcvbn->pack_table_size * sizeof(struct zxcvbn_node *);
+/* Layouts ================================================================== */
 
-    if ((memory =__malloc(zxcvbn, size)) == NULL)
-        return NULL;
+#define LAYOUT_X_SIZE   16
+#define LAYOUT_Y_SIZE   7
 
-    memset(memory, 0, size);
-    node = (struct zxcvbn_node *)memory;
-    node->children = (struct zxcvbn_node **)(memory + sizeof(*node));
-    node->rank = -1;
+// directions by (dy + 1, dx + 1), the same key is the last one
+static const int8_t slant_directions[3][3] = {
+    { -1,  1,  2 },
+    {  0,  6,  3 },
+    {  5,  4, -1 },
+};
 
-    return node;
-}
+static const int8_t aligned_directions[3][3] = {
+    {  1,  2,  3 },
+    {  0,  8,  4 },
+    {  7,  6,  5 },
+};
 
-struct zxcvbn_dict *
-zxcvbn_dict_init(struct zxcvbn *zxcvbn, struct zxcvbn_dict *dict_buf, const char *name)
+static int
+layout_find(struct zxcvbn *zxcvbn, const char *name)
 {
-    struct zxcvbn_dict *dict;
+    unsigned int g;
 
-    if (dict_buf != NULL) {
-        dict = dict_buf;
-        dict->allocated = 0;
-    } else {
-        if ((dict = __malloc(zxcvbn, sizeof(struct zxcvbn_dict))) == NULL)
-            return NULL;
-        dict->allocated = 1;
-    }
-        
-    dict->zxcvbn = zxcvbn;
-    strncpy(dict->name, name, sizeof(dict->name));
-    dict->name[sizeof(dict->name) - 1] = '\0';
-    if ((dict->root = make_node(zxcvbn)) == NULL) {
-        zxcvbn_dict_release(dict);
-        return NULL;
+    for (g = 0; g < zxcvbn->n_layouts; ++g) {
+        if (strcmp(zxcvbn->layouts[g]->name, name) == 0)
+            return g;
     }
 
-    LIST_INSERT_HEAD(&zxcvbn->dict_head, dict, list);
-
-    return dict;
+    return -1;
 }
 
-int
-zxcvbn_dict_add_word(struct zxcvbn_dict *dict, const char *word, unsigned int word_len, unsigned int rank)
+static int
+spatial_key_cmp(const void *a, const void *b)
 {
-    int i;
-    unsigned int len;
-    char word_buf[ZXCVBN_PASSWORD_LEN_MAX];
-    struct zxcvbn_node *node, *parent;
+    const struct zxcvbn_spatial_key *ka = a, *kb = b;
 
-    len = MIN(word_len, sizeof(word_buf));
+    return ka->ch < kb->ch ? -1 : ka->ch > kb->ch;
+}
 
-    if (pow(26, len) < rank) {
-        // bruteforce possibilities are less then word rank.
-        return 0;
+static void
+make_spatial_entropy_table(struct zxcvbn_spatial_graph *spatial_graph)
+{
+    unsigned int length, turns;
+    double possibilities;
+
+    for (turns = 0; turns < ZXCVBN_ENTROPY_TABLE_LEN; ++turns) {
+        possibilities = 0;
+        for (length = 1; length < ZXCVBN_ENTROPY_TABLE_LEN; ++length) {
+            if (length >= 2)
+                possibilities = spatial_possibilities(spatial_graph, possibilities, length, turns);
+            spatial_graph->entropy[length][turns] = log2(possibilities);
+        }
     }
+}
 
-    pack_word(dict->zxcvbn, word_buf, word, len);
+int
+zxcvbn_layout_add(struct zxcvbn *zxcvbn, const char *name, const char *desc, unsigned int flags)
+{
+    struct zxcvbn_spatial_graph *spatial_graph;
+    struct zxcvbn_spatial_key *wide_keys;
+    uint8_t n_key_chars[LAYOUT_Y_SIZE][LAYOUT_X_SIZE];
+    unsigned int x, y, k, n, dx, dy, n_wide_keys, desc_len;
+    const char *s;
+    char *name_copy;
+    uint32_t ch, bit;
+
+    if (zxcvbn->n_layouts == ZXCVBN_LAYOUTS_MAX || layout_find(zxcvbn, name) >= 0)
+        return -1;
 
-    parent = dict->root;
+    // a key per byte of desc at most
+    desc_len = strlen(desc);
+    spatial_graph = __malloc(zxcvbn, sizeof(*spatial_graph) +
+                             desc_len * sizeof(*wide_keys) + strlen(name) + 1);
+    if (spatial_graph == NULL)
+        return -1;
 
-    for (i = 0;; ++i) {
-        if ((node = parent->children[(unsigned char) word_buf[i]]) == NULL) {
-            if ((node = make_node(dict->zxcvbn)) == NULL)
-                return -1;
-            parent->children[(unsigned char) word_buf[i]] = node; 
+    memset(spatial_graph, 0, sizeof(*spatial_graph));
+    memset(spatial_graph->keys, ZXCVBN_KEY_NONE, sizeof(spatial_graph->keys));
+    wide_keys = (void *) (spatial_graph + 1);
+    name_copy = (char *) (wide_keys + desc_len);
+    strcpy(name_copy, name);
+
+    memset(n_key_chars, 0, sizeof(n_key_chars));
+    x = y = k = 0;
+    n_wide_keys = 0;
+    for (s = desc; *s != '\0'; s += n) {
+        n = 1;
+        if (*s == '\r')
+            continue;
+        if (*s == ' ' || *s == '\n') {
+            if (*s == ' ')
+                ++x;
+            else {
+                x = 0;
+                ++y;
+            }
+            k = 0;
+            continue;
         }
 
-        if (i == len - 1) {
-            if (node->rank == -1 || node->rank > rank)
-                node->rank = rank;
-            break;
+        if (x >= LAYOUT_X_SIZE || y >= LAYOUT_Y_SIZE)
+            goto error;
+
+        ch = utf8_decode(s, desc + desc_len - s, &n);
+        if (ch == UTF8_INVALID || ch < ' ')
+            goto error;
+
+        if (ch < ARRAY_SIZE(spatial_graph->keys)) {
+            if (spatial_graph->keys[ch] != ZXCVBN_KEY_NONE)
+                goto error;
+            spatial_graph->keys[ch] = y << 4 | x | (k > 0 ? ZXCVBN_KEY_SHIFTED : 0);
+        } else {
+            wide_keys[n_wide_keys].ch = ch;
+            wide_keys[n_wide_keys].key = y << 4 | x | (k > 0 ? ZXCVBN_KEY_SHIFTED : 0);
+            ++n_wide_keys;
         }
+        n_key_chars[y][x] = ++k;
+    }
 
-        parent = node;
+    qsort(wide_keys, n_wide_keys, sizeof(*wide_keys), spatial_key_cmp);
+    for (k = 1; k < n_wide_keys; ++k) {
+        if (wide_keys[k].ch == wide_keys[k - 1].ch)
+            goto error;
     }
 
-    return 1;
+    spatial_graph->name = name_copy;
+    spatial_graph->wide_keys = wide_keys;
+    spatial_graph->n_wide_keys = n_wide_keys;
+    memcpy(spatial_graph->directions,
+           flags & ZXCVBN_LAYOUT_ALIGNED ? aligned_directions : slant_directions,
+           sizeof(spatial_graph->directions));
+
+    // average number of neighbor keys of a char
+    for (y = 0; y < LAYOUT_Y_SIZE; ++y) {
+        for (x = 0; x < LAYOUT_X_SIZE; ++x) {
+            if (n_key_chars[y][x] == 0)
+                continue;
+
+            spatial_graph->n_chars += n_key_chars[y][x];
+            for (dy = 0; dy < 3; ++dy) {
+                for (dx = 0; dx < 3; ++dx) {
+                    if ((dx == 1 && dy == 1) || spatial_graph->directions[dy][dx] < 0)
+                        continue;
+                    if (x + dx < 1 || x + dx > LAYOUT_X_SIZE ||
+                            y + dy < 1 || y + dy > LAYOUT_Y_SIZE)
+                        continue;
+                    if (n_key_chars[y + dy - 1][x + dx - 1] > 0)
+                        spatial_graph->degree += n_key_chars[y][x];
+                }
+            }
+        }
+    }
+    if (spatial_graph->n_chars == 0)
+        goto error;
+    spatial_graph->degree /= spatial_graph->n_chars;
+
+    make_spatial_entropy_table(spatial_graph);
+
+    bit = (uint32_t) 1 << zxcvbn->n_layouts;
+    zxcvbn->layouts[zxcvbn->n_layouts++] = spatial_graph;
+    zxcvbn->allocated_layouts |= bit;
+    zxcvbn->active_layouts |= bit;
+    layouts_update(zxcvbn);
+
+    return 0;
+
+error:
+    __free(zxcvbn, spatial_graph);
+    return -1;
+}
+
+int
+zxcvbn_layout_set_active(struct zxcvbn *zxcvbn, const char *name, int active)
+{
+    int g;
+
+    if ((g = layout_find(zxcvbn, name)) < 0)
+        return -1;
+
+    if (active)
+        zxcvbn->active_layouts |= (uint32_t) 1 << g;
+    else
+        zxcvbn->active_layouts &= ~((uint32_t) 1 << g);
+    layouts_update(zxcvbn);
+
+    return 0;
 }
+
+/* Layouts ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
@@ -9,6 +9,18 @@
 LIST_HEAD(zxcvbn_dict_head, zxcvbn_dict);
 
 struct zxcvbn_node;
+struct zxcvbn_trie_block;
+struct zxcvbn_automaton;
+struct zxcvbn_dict_set;
+
+/*
+ * Passwords are of any length. Repeats, sequences, digits and spatial walks
+ * longer than this are matched in pieces of at most this many chars. A
+ * sequence match also takes the char after its piece, as it always has.
+ */
+#ifndef ZXCVBN_MATCH_SPAN_MAX
+#define ZXCVBN_MATCH_SPAN_MAX   256
+#endif
 
 #define ZXCVBN_DATE_ONLY_YEAR   (1 << 0)
 #define ZXCVBN_DATE_FULL_YEAR   (1 << 1)
@@ -29,6 +41,13 @@ struct zxcvbn_opts {
     const char         *symbols;
     unsigned int        max_matches_num;
     unsigned int        skipped_match_types;
+    /* alphabets matched as sequences in addition to the built in ones */
+    const char *const  *sequences;
+    unsigned int        n_sequences;
+    /* results of short passwords kept by zxcvbn_match_ex(), 0 for no cache */
+    unsigned int        cache_size;
+    /* collect struct zxcvbn_stats of every match, a clock read per stage */
+    int                 stats;
 };
 
 struct zxcvbn_date {
@@ -38,12 +57,63 @@ struct zxcvbn_date {
     uint8_t     flags;
 };
 
+/* entropy tables cover matches shorter than this */
+#define ZXCVBN_ENTROPY_TABLE_LEN    32
+#define ZXCVBN_RANK_TABLE_SIZE      1024
+
+#define ZXCVBN_LAYOUTS_MAX  32
+/* keys of the layout are in columns, like on a keypad */
+#define ZXCVBN_LAYOUT_ALIGNED   (1 << 0)
+
+/* key of a char on a spatial graph: y << 4 | x, shifted chars have bit 7 set */
+#define ZXCVBN_KEY_NONE     0xff
+#define ZXCVBN_KEY_SHIFTED  0x80
+
+/* key of a char out of ASCII */
+struct zxcvbn_spatial_key {
+    uint32_t ch;
+    uint8_t key;
+};
+
 struct zxcvbn_spatial_graph {
-    const char *data[256][9];
+    const char *name;
+    uint8_t keys[128];
+    /* sorted by ch */
+    const struct zxcvbn_spatial_key *wide_keys;
+    unsigned int n_wide_keys;
+    /* direction from a key to the key at (x + dx, y + dy), -1 if not adjacent */
+    int8_t directions[3][3];
     double degree;
     unsigned int n_chars;
-    unsigned int token_size;
-    unsigned int n_coords;
+    /* entropy by length and turns, turns < length */
+    double entropy[ZXCVBN_ENTROPY_TABLE_LEN][ZXCVBN_ENTROPY_TABLE_LEN];
+};
+
+/* classes of chars, upper is the case bit of ASCII letters */
+#define ZXCVBN_CLASS_DIGIT      (1 << 0)
+#define ZXCVBN_CLASS_LOWER      (1 << 1)
+#define ZXCVBN_CLASS_SYMBOL     (1 << 2)
+#define ZXCVBN_CLASS_SEPARATOR  (1 << 3)
+#define ZXCVBN_CLASS_UPPER      0x20
+
+#define ZXCVBN_SEQUENCES_MAX    32
+#define ZXCVBN_SEQUENCE_NONE    0xff
+
+struct zxcvbn_sequence {
+    const char *str;
+    unsigned int len;
+    unsigned int extra_entropy;
+    /* index of the first occurrence of a char in str */
+    uint8_t index[256];
+};
+
+/* double-array trie, node 0 is the root */
+struct zxcvbn_trie {
+    struct zxcvbn_node *nodes;
+    unsigned int n_nodes;
+    unsigned int n_codes;
+    struct zxcvbn_trie_block *blocks;
+    int block_heads[3];
 };
 
 struct zxcvbn_dict {
@@ -51,9 +121,16 @@ struct zxcvbn_dict {
     LIST_ENTRY(zxcvbn_dict) list;
     int allocated;
     char name[PATH_MAX];
-    struct zxcvbn_node *root;
+    struct zxcvbn_trie trie;
+    /* image mapped by zxcvbn_dict_load_mmap(), read-only */
+    void *map;
+    size_t map_size;
 };
 
+struct zxcvbn_cache_slot;
+struct zxcvbn_breach;
+struct zxcvbn_stats_shard;
+
 struct zxcvbn {
     int allocated;
     void *(*zxcvbn_malloc)(size_t size);
@@ -63,12 +140,40 @@ struct zxcvbn {
     char pack_table[256];
     unsigned int pack_table_size;
     struct zxcvbn_dict_head dict_head;
-    struct zxcvbn_spatial_graph spatial_graph_qwerty;
-    struct zxcvbn_spatial_graph spatial_graph_dvorak;
-    struct zxcvbn_spatial_graph spatial_graph_keypad;
-    struct zxcvbn_spatial_graph spatial_graph_macpad;
+    /* built by zxcvbn_dict_compile(), dropped when dictionaries change */
+    struct zxcvbn_automaton *automaton;
+    /* breach corpus mapped by zxcvbn_breach_load_mmap() */
+    struct zxcvbn_breach *breach;
+    /* current dictionary set, pinned by matching */
+    struct zxcvbn_dict_set *dict_set;
+    unsigned int dict_set_epoch;
+    unsigned long dict_set_readers[2];
+    /* keyboard layouts, built in ones are generated by zxcvbn_gen */
+    const struct zxcvbn_spatial_graph *layouts[ZXCVBN_LAYOUTS_MAX];
+    unsigned int n_layouts;
+    /* masks by index in layouts */
+    uint32_t active_layouts;
+    uint32_t wide_layouts;
+    uint32_t allocated_layouts;
+    /* active layouts having an ASCII char */
+    uint32_t layout_masks[128];
+    /* sequences, built in ones are generated by zxcvbn_gen */
+    const struct zxcvbn_sequence *sequences[ZXCVBN_SEQUENCES_MAX];
+    unsigned int n_sequences;
+    /* sequences having a char */
+    const uint32_t *sequence_masks;
     unsigned int max_matches_num;
     unsigned int skipped_match_types;
+    /* slots of the result cache, a power of two, NULL without cache */
+    struct zxcvbn_cache_slot *cache;
+    unsigned int cache_mask;
+    /* bumped when dictionaries or layouts change, older slots are stale */
+    unsigned long cache_generation;
+    unsigned long cache_hits;
+    unsigned long cache_misses;
+    /* stats of all matches summed by thread, NULL if disabled */
+    struct zxcvbn_stats_shard *stats;
+    void *stats_block;
 };
 
 enum zxcvbn_match_type {
@@ -79,6 +184,7 @@ enum zxcvbn_match_type {
     ZXCVBN_MATCH_TYPE_SEQUENCE,
     ZXCVBN_MATCH_TYPE_REPEAT,
     ZXCVBN_MATCH_TYPE_BRUTEFORCE,
+    ZXCVBN_MATCH_TYPE_BREACH,
 };
 
 // match type masks
@@ -89,16 +195,19 @@ enum zxcvbn_match_type {
 #define ZXCVBN_MATCH_TYPE_REPEAT_M      (1 << ZXCVBN_MATCH_TYPE_REPEAT)
 #define ZXCVBN_MATCH_TYPE_DICT_M        (1 << ZXCVBN_MATCH_TYPE_DICT)
 #define ZXCVBN_MATCH_TYPE_BRUTEFORCE_M  (1 << ZXCVBN_MATCH_TYPE_BRUTEFORCE)
+#define ZXCVBN_MATCH_TYPE_BREACH_M      (1 << ZXCVBN_MATCH_TYPE_BREACH)
+
+#define ZXCVBN_MATCH_TYPES_NUM  (ZXCVBN_MATCH_TYPE_BREACH + 1)
 
 #define ZXCVBN_MATCH_DESC_SEQ   (1 << 0)
 
 struct zxcvbn_match {
     enum zxcvbn_match_type type;
     CIRCLEQ_ENTRY(zxcvbn_match) list;
-    struct zxcvbn_spatial_graph *spatial_graph;
+    const struct zxcvbn_spatial_graph *spatial_graph;
     union {
-        struct zxcvbn_sequence     *seq;
-        struct zxcvbn_date          date;
+        const struct zxcvbn_sequence *seq;
+        struct zxcvbn_date            date;
     };
     uint8_t                         flags;
     int i, j;
@@ -110,14 +219,81 @@ struct zxcvbn_match {
 
 CIRCLEQ_HEAD(zxcvbn_match_head, zxcvbn_match);
 
+/* the fields of a candidate that depend on its type */
+union zxcvbn_candidate_aux {
+    unsigned int                            rank;
+    const struct zxcvbn_sequence            *seq;
+    struct zxcvbn_date                      date;
+    struct {
+        const struct zxcvbn_spatial_graph   *graph;
+        uint16_t                            turns;
+        uint16_t                            shifted;
+    } spatial;
+};
+
+/* bytes taken by a candidate, to size buffers of zxcvbn_res_init_arena() */
+#define ZXCVBN_CANDIDATE_SIZE   (sizeof(double) + sizeof(union zxcvbn_candidate_aux) + \
+                                 2 * sizeof(uint32_t) + 2 * sizeof(uint8_t))
+
+/*
+ * Matches found in a password, a column per field. Only the matches of the
+ * lowest entropy path are filled in as struct zxcvbn_match.
+ */
+struct zxcvbn_candidates {
+    double                      *entropy;
+    union zxcvbn_candidate_aux  *aux;
+    uint32_t                    *i;
+    uint32_t                    *j;
+    uint8_t                     *type;
+    uint8_t                     *flags;
+    unsigned int                n;
+    unsigned int                n_reserved;
+};
+
+enum zxcvbn_stage {
+    ZXCVBN_STAGE_ANALYZE,
+    ZXCVBN_STAGE_SPATIAL,
+    ZXCVBN_STAGE_DIGITS,
+    ZXCVBN_STAGE_DATE,
+    ZXCVBN_STAGE_SEQUENCE,
+    ZXCVBN_STAGE_REPEAT,
+    ZXCVBN_STAGE_BREACH,
+    ZXCVBN_STAGE_DICT,
+    ZXCVBN_STAGE_ENTROPY,
+    ZXCVBN_STAGE_MIN_ENTROPY,
+    ZXCVBN_STAGES_NUM,
+};
+
+/* counters of matches, all of them are uint64_t */
+struct zxcvbn_stats {
+    uint64_t calls;
+    uint64_t stage_ns[ZXCVBN_STAGES_NUM];
+    /* candidate matches by type, a cache hit has none */
+    uint64_t matches[ZXCVBN_MATCH_TYPES_NUM];
+    /* trie nodes and automaton states visited */
+    uint64_t trie_nodes;
+    /* growths of candidate and path storage */
+    uint64_t reallocs;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+};
+
 struct zxcvbn_res {
     struct zxcvbn *zxcvbn;
+    struct zxcvbn_candidates candidates;
+    uint64_t candidate_buf[128];
+    void *arena;
+    /* buffers of zxcvbn_match_batch() shared by its items */
+    struct zxcvbn_scratch *scratch;
+    /* lowest entropy path, linked in order by match_head */
     struct zxcvbn_match_head match_head;
-    struct zxcvbn_match match_buf[32];
+    struct zxcvbn_match match_buf[8];
     struct zxcvbn_match *matches;
     unsigned int n_matches;
     unsigned int n_matches_reserved;
     double entropy;
+    /* of the last match, only with stats enabled */
+    struct zxcvbn_stats stats;
 };
 
 struct zxcvbn *
@@ -136,22 +312,288 @@ zxcvbn_dict_init(struct zxcvbn *zxcvbn, struct zxcvbn_dict *dict_buf, const char
 int
 zxcvbn_dict_add_word(struct zxcvbn_dict *dict, const char *word, unsigned int word_len, unsigned int rank);
 
+/* write dict as an image for zxcvbn_dict_load_mmap() */
+int
+zxcvbn_dict_save(struct zxcvbn_dict *dict, const char *path);
+
+/*
+ * map an image written by zxcvbn_dict_save(), words can't be added to it.
+ * The image must be saved by a zxcvbn with the same symbols. An image with
+ * nodes pointing out of it is rejected.
+ */
+struct zxcvbn_dict *
+zxcvbn_dict_load_mmap(struct zxcvbn *zxcvbn, struct zxcvbn_dict *dict_buf,
+                      const char *name, const char *path);
+
+/* match all dictionaries in one pass, call after all words are added */
+int
+zxcvbn_dict_compile(struct zxcvbn *zxcvbn);
+
+/*
+ * Dictionary sets. A set is the compiled automaton of all dictionaries of a
+ * zxcvbn and is matched in addition to the dictionaries of the zxcvbn using
+ * it. The set of a zxcvbn may be replaced while other threads are matching:
+ * zxcvbn_match() never blocks, while calls replacing the set (attach, refresh,
+ * install, detach) block until matches in flight with the replaced set have
+ * returned and then release it. zxcvbn_match_batch() holds the set for one
+ * item at a time. Calls replacing the set must not run concurrently with each
+ * other.
+ *
+ * Shared sets live in POSIX shared memory. Every publish creates a new
+ * generation of the set, processes attached to it switch to the newest
+ * generation in zxcvbn_dict_set_refresh(). Only one process may publish a set
+ * at a time.
+ */
+int
+zxcvbn_dict_set_publish(struct zxcvbn *zxcvbn, const char *name);
+
+int
+zxcvbn_dict_set_attach(struct zxcvbn *zxcvbn, const char *name);
+
+/* returns 1 if a newer generation was attached, 0 if there is none */
+int
+zxcvbn_dict_set_refresh(struct zxcvbn *zxcvbn);
+
+/*
+ * make the compiled dictionaries of src the set of zxcvbn, src keeps its
+ * dictionaries. Both must have the same symbols and allocator.
+ */
+int
+zxcvbn_dict_set_install(struct zxcvbn *zxcvbn, struct zxcvbn *src);
+
+/* 0 if there is no set */
+uint64_t
+zxcvbn_dict_set_generation(struct zxcvbn *zxcvbn);
+
+void
+zxcvbn_dict_set_detach(struct zxcvbn *zxcvbn);
+
+/* remove the set, attached processes keep their generation */
+int
+zxcvbn_dict_set_unlink(const char *name);
+
+/*
+ * Breach corpus: exact passwords with their rank, most common first from 1.
+ * A corpus is built with zxcvbn_breach_add() and saved as an image, which is
+ * mapped read-only and shared by the processes mapping it. A password of the
+ * mapped corpus is matched as a whole with the entropy of its rank. Passwords
+ * are kept as 64 bit hashes, so out of the corpus one may match with a tiny
+ * probability.
+ */
+struct zxcvbn_breach *
+zxcvbn_breach_init(struct zxcvbn *zxcvbn);
+
+int
+zxcvbn_breach_add(struct zxcvbn_breach *breach,
+                  const char *password, unsigned int password_len, unsigned int rank);
+
+/* a password added more than once keeps its lowest rank */
+int
+zxcvbn_breach_save(struct zxcvbn_breach *breach, const char *path);
+
+/*
+ * map an image written by zxcvbn_breach_save() as the corpus of zxcvbn,
+ * releasing the previous one. Must not be called while matching.
+ */
+struct zxcvbn_breach *
+zxcvbn_breach_load_mmap(struct zxcvbn *zxcvbn, const char *path);
+
+void
+zxcvbn_breach_release(struct zxcvbn_breach *breach);
+
+/*
+ * Keyboard layouts. qwerty, dvorak, keypad and macpad are built in, all
+ * layouts are active when added. desc has a line per row of keys, keys are
+ * separated by a space and an empty key is a gap. The first char of a key is
+ * typed without shift, the others with it. Chars are UTF-8.
+ *
+ * Layouts must not be added or (de)activated while matching.
+ */
+int
+zxcvbn_layout_add(struct zxcvbn *zxcvbn, const char *name, const char *desc, unsigned int flags);
+
+int
+zxcvbn_layout_set_active(struct zxcvbn *zxcvbn, const char *name, int active);
+
 void
 zxcvbn_res_init(struct zxcvbn_res *res, struct zxcvbn *zxcvbn);
 
+/*
+ * keep candidate matches in size bytes at buf, which must outlive res, room
+ * for size / ZXCVBN_CANDIDATE_SIZE of them once buf is aligned. When they
+ * don't fit, they move to the heap growing twice at a time.
+ */
+void
+zxcvbn_res_init_arena(struct zxcvbn_res *res, struct zxcvbn *zxcvbn,
+                      void *buf, size_t size);
+
+/* forget the matches to reuse res for another password, keeps its storage */
+void
+zxcvbn_res_reset(struct zxcvbn_res *res);
+
 void
 zxcvbn_res_release(struct zxcvbn_res *res);
 
+/*
+ * Matching doesn't modify its arguments except res, and of zxcvbn only writes
+ * the readers of its dictionary set, the result cache slots with their hit
+ * and miss counters and the stats, all with atomics. So threads may match
+ * concurrently with one zxcvbn, each with its own res. Dictionaries of the
+ * zxcvbn must not be added, compiled or released meanwhile, its dictionary
+ * set may be replaced.
+ */
 int
 zxcvbn_match(struct zxcvbn_res *res,
-             const char *password, unsigned int password_len,
-             char **words,         unsigned int words_num);
+             const char *password,     unsigned int password_len,
+             const char *const *words, unsigned int words_num);
 
 int
 zxcvbn_match_ex(struct zxcvbn_res *res,
-                const char *password,      unsigned int password_len,
-                char **words,              unsigned int words_num,
-                struct zxcvbn_date *dates, unsigned int dates_num);
+                const char *password,            unsigned int password_len,
+                const char *const *words,        unsigned int words_num,
+                const struct zxcvbn_date *dates, unsigned int dates_num);
+
+/*
+ * Returns 1 if the entropy of password is at least min_bits, 0 if it is lower.
+ * A password whose bruteforce entropy is already lower is not matched, then res
+ * has a single bruteforce match, else res is as after zxcvbn_match_ex().
+ */
+int
+zxcvbn_check_threshold(struct zxcvbn_res *res,
+                       const char *password,            unsigned int password_len,
+                       const char *const *words,        unsigned int words_num,
+                       const struct zxcvbn_date *dates, unsigned int dates_num,
+                       double min_bits);
+
+struct zxcvbn_batch_item {
+    const char                 *password;
+    unsigned int                password_len;
+    const char *const          *words;
+    unsigned int                words_num;
+    const struct zxcvbn_date   *dates;
+    unsigned int                dates_num;
+    /* set by zxcvbn_match_batch() */
+    double                      entropy;
+};
+
+/*
+ * Match every item as zxcvbn_match_ex() would and set its entropy. If results
+ * is not NULL it must have room for n_items results, each is initialized and
+ * gets the matches of its item, the caller releases all of them. Stops at the
+ * first item that fails, its entropy is set to 0. Buffers of passwords too
+ * long for the stack are allocated once and reused by the following items.
+ */
+int
+zxcvbn_match_batch(struct zxcvbn *zxcvbn,
+                   struct zxcvbn_batch_item *items, unsigned int n_items,
+                   struct zxcvbn_res *results);
+
+/*
+ * Result cache of zxcvbn_init_ex() opts. zxcvbn_match_ex() and
+ * zxcvbn_match_batch() look up passwords with their words and dates and store
+ * the entropy and path, hits have no candidates. Passwords longer than 32
+ * bytes and paths of more than 8 matches aren't cached. A slot may be replaced
+ * by another password, the cache is emptied when dictionaries, the dictionary
+ * set or layouts change.
+ */
+void
+zxcvbn_cache_stats(struct zxcvbn *zxcvbn, unsigned long *hits, unsigned long *misses);
+
+/* empty the cache, counters are kept */
+void
+zxcvbn_cache_clear(struct zxcvbn *zxcvbn);
+
+/*
+ * Stats of all matches of zxcvbn since it was initialized or reset, -1 if
+ * stats are disabled. Matches add to counters of their thread, so reading
+ * and resetting don't stop them and may see a match partly.
+ */
+int
+zxcvbn_stats_get(struct zxcvbn *zxcvbn, struct zxcvbn_stats *stats);
+
+void
+zxcvbn_stats_reset(struct zxcvbn *zxcvbn);
+
+const char *
+zxcvbn_stage_string(enum zxcvbn_stage stage);
+
+/*
+ * Scoring of a password while it is typed. The session keeps the analysis of
+ * each char, where each matcher may go on differently, the matches by end
+ * and the lowest entropy path of each prefix. A change has matchers look
+ * again from the start of their last open run, at most ZXCVBN_MATCH_SPAN_MAX
+ * chars back but for spatial walks on several layouts at once, compiled
+ * dictionaries from the first changed char, and the path is redone from the
+ * first position whose matches may have changed up to where it meets the
+ * previous one.
+ */
+struct zxcvbn_session {
+    /* matches and entropy of the password so far */
+    struct zxcvbn_res res;
+    const char *const *words;
+    unsigned int words_num;
+    const struct zxcvbn_date *dates;
+    unsigned int dates_num;
+    /* columns of a char each, grown with the password */
+    char *password;
+    unsigned int password_len;
+    unsigned int password_reserved;
+    /* classes of each char and of those up to it, its packed char */
+    uint8_t *classes;
+    uint8_t *masks;
+    char *pack;
+    /* upper, lower and UTF-8 chars before each char, negated */
+    uint32_t *uppers;
+    uint32_t *lowers;
+    uint32_t *utf8_chars;
+    /* start of the run of equal chars and of digits each char is in */
+    uint32_t *char_starts;
+    uint32_t *digit_starts;
+    /* where spatial walks, sequences and dates can be looked for again */
+    uint32_t *spatial_fresh;
+    uint32_t *sequence_steps;
+    uint32_t *date_steps;
+    /* hash of the password up to each char */
+    uint64_t *hashes;
+    int *set_states;
+    int *states;
+    const struct zxcvbn_dict_set *set;
+    uint64_t set_generation;
+    /* candidates of res by end, the first ending at each char and their matchers */
+    int *ends;
+    uint32_t *ranks;
+    int *order;
+    unsigned int n_ranks_reserved;
+    /* lowest entropy path of each prefix and the matches it was found with */
+    unsigned int bruteforce_card;
+    double *pos_entropy;
+    int *path;
+    /* match of res where the walk of the path stops at each char */
+    int *path_matches;
+    int allocated;
+};
+
+/*
+ * words and dates must outlive the session. Scoring gives the result of
+ * zxcvbn_match_ex() on the password, its password is emptied when scoring
+ * fails. A session must be emptied with zxcvbn_session_truncate(session, 0)
+ * after dictionaries of the zxcvbn change.
+ */
+struct zxcvbn_session *
+zxcvbn_session_init(struct zxcvbn *zxcvbn, struct zxcvbn_session *session_buf,
+                    const char *const *words,        unsigned int words_num,
+                    const struct zxcvbn_date *dates, unsigned int dates_num);
+
+/* append len bytes to the password and score it in session->res */
+int
+zxcvbn_session_append(struct zxcvbn_session *session, const char *str, unsigned int len);
+
+/* cut the password to len bytes and score it */
+int
+zxcvbn_session_truncate(struct zxcvbn_session *session, unsigned int len);
+
+void
+zxcvbn_session_release(struct zxcvbn_session *session);
 
 const char *
 zxcvbn_match_type_string(enum zxcvbn_match_type type);
@@ -0,0 +1,834 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "zxcvbn.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define SYMBOLS         "!@#$%^&*()-_+=;:,./?\\|`~[]{}"
+#define WORD_LEN_MAX    64
+#define PASSWORD_LEN_MAX    8192
+
+/* Allocations ============================================================== */
+
+static unsigned long n_allocs;
+
+static void *
+bench_malloc(size_t size)
+{
+    n_allocs++;
+    return malloc(size);
+}
+
+static void *
+bench_realloc(void *ptr, size_t size)
+{
+    n_allocs++;
+    return realloc(ptr, size);
+}
+
+static void
+bench_free(void *ptr)
+{
+    free(ptr);
+}
+
+/* Allocations ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Corpora ================================================================== */
+
+struct corpus {
+    const char *name;
+    char **passwords;
+    unsigned int n;
+    unsigned int n_reserved;
+};
+
+struct words {
+    char **words;
+    unsigned int n;
+    unsigned int n_reserved;
+};
+
+static int
+strings_add(char ***strings, unsigned int *n, unsigned int *n_reserved,
+            const char *str, size_t len)
+{
+    char **p, *s;
+
+    if (*n == *n_reserved) {
+        *n_reserved = *n_reserved ? *n_reserved * 2 : 1024;
+        if ((p = realloc(*strings, sizeof(*p) * *n_reserved)) == NULL)
+            return -1;
+        *strings = p;
+    }
+    if ((s = strndup(str, len)) == NULL)
+        return -1;
+    (*strings)[(*n)++] = s;
+    return 0;
+}
+
+static int
+corpus_add(struct corpus *corpus, const char *password, size_t len)
+{
+    if (len == 0 || len > PASSWORD_LEN_MAX)
+        return 0;
+    return strings_add(&corpus->passwords, &corpus->n, &corpus->n_reserved,
+                       password, len);
+}
+
+static void
+corpus_release(struct corpus *corpus)
+{
+    unsigned int i;
+
+    for (i = 0; i < corpus->n; ++i)
+        free(corpus->passwords[i]);
+    free(corpus->passwords);
+}
+
+// one password per line, words are collected for the synthetic corpora
+static int
+read_lines(const char *path, struct corpus *corpus, struct words *words)
+{
+    char buf[1024];
+    size_t len;
+    FILE *file;
+
+    if ((file = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "fopen(\"%s\") failed (%d:%s)\n", path, errno, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(buf, sizeof(buf), file) != NULL) {
+        len = strcspn(buf, "\r\n");
+        if (len == 0)
+            continue;
+        if ((corpus && corpus_add(corpus, buf, len) < 0) ||
+                (words && len <= WORD_LEN_MAX &&
+                 strings_add(&words->words, &words->n, &words->n_reserved, buf, len) < 0)) {
+            fprintf(stderr, "out of memory reading \"%s\"\n", path);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static uint64_t rng_state;
+
+// xorshift64*, corpora are the same for the same seed
+static uint64_t
+rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static unsigned int
+rng_range(unsigned int lo, unsigned int hi)
+{
+    return lo + rng() % (hi - lo + 1);
+}
+
+static unsigned int
+append(char *buf, unsigned int len, const char *str, unsigned int str_len)
+{
+    str_len = len + str_len > PASSWORD_LEN_MAX ? PASSWORD_LEN_MAX - len : str_len;
+    memcpy(buf + len, str, str_len);
+    return len + str_len;
+}
+
+static const char *
+random_word(const struct words *words)
+{
+    return words->words[rng() % words->n];
+}
+
+static void
+mangle(char *word, unsigned int len)
+{
+    static const char l33t[][2] = {
+        {'a', '4'}, {'a', '@'}, {'e', '3'}, {'i', '1'}, {'o', '0'}, {'s', '$'},
+    };
+    unsigned int i, k;
+
+    if (rng() % 3 == 0 && word[0] >= 'a' && word[0] <= 'z')
+        word[0] -= 'a' - 'A';
+    if (rng() % 4 != 0)
+        return;
+    for (i = 0; i < len; ++i) {
+        for (k = 0; k < ARRAY_SIZE(l33t); ++k) {
+            if (word[i] == l33t[k][0] && rng() % 2)
+                word[i] = l33t[k][1];
+        }
+    }
+}
+
+// words glued with digits and symbols up to min..max chars
+static int
+gen_long(struct corpus *corpus, const struct words *words, unsigned int n,
+         unsigned int min, unsigned int max)
+{
+    char buf[PASSWORD_LEN_MAX], chunk[16];
+    unsigned int i, len, target;
+    const char *word;
+
+    for (i = 0; i < n; ++i) {
+        target = rng_range(min, max);
+        for (len = 0; len < target;) {
+            switch (rng() % 3) {
+            case 0:
+                word = random_word(words);
+                len = append(buf, len, word, strlen(word));
+                break;
+            case 1:
+                len = append(buf, len, chunk,
+                             snprintf(chunk, sizeof(chunk), "%u", (unsigned int) rng() % 100000));
+                break;
+            default:
+                chunk[0] = SYMBOLS[rng() % (sizeof(SYMBOLS) - 1)];
+                len = append(buf, len, chunk, 1);
+                break;
+            }
+        }
+        if (corpus_add(corpus, buf, MIN(len, target)) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// two to four words, capitalized, l33t and separated at random
+static int
+gen_dict(struct corpus *corpus, const struct words *words, unsigned int n)
+{
+    static const char separators[] = "-_. ";
+    char buf[PASSWORD_LEN_MAX], word[WORD_LEN_MAX + 1];
+    unsigned int i, k, n_words, len, word_len;
+
+    for (i = 0; i < n; ++i) {
+        n_words = rng_range(2, 4);
+        for (k = 0, len = 0; k < n_words; ++k) {
+            if (k > 0 && rng() % 3 == 0)
+                len = append(buf, len, separators + rng() % (sizeof(separators) - 1), 1);
+            word_len = strlen(strcpy(word, random_word(words)));
+            mangle(word, word_len);
+            len = append(buf, len, word, word_len);
+        }
+        if (corpus_add(corpus, buf, len) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// a word around one or two dates in the formats people type
+static int
+gen_date(struct corpus *corpus, const struct words *words, unsigned int n)
+{
+    static const char *const separators[] = {"", ".", "-", "/", " "};
+    char buf[PASSWORD_LEN_MAX], date[32], year[8];
+    unsigned int i, k, n_dates, len, day, month;
+    const char *word, *sep;
+
+    for (i = 0; i < n; ++i) {
+        len = 0;
+        if (rng() % 2) {
+            word = random_word(words);
+            len = append(buf, len, word, strlen(word));
+        }
+        n_dates = rng_range(1, 2);
+        for (k = 0; k < n_dates; ++k) {
+            day = rng_range(1, 31);
+            month = rng_range(1, 12);
+            sep = separators[rng() % ARRAY_SIZE(separators)];
+            if (rng() % 2)
+                snprintf(year, sizeof(year), "%u", rng_range(1940, 2030));
+            else
+                snprintf(year, sizeof(year), "%02u", rng_range(0, 99));
+            switch (rng() % 3) {
+            case 0:
+                snprintf(date, sizeof(date), "%02u%s%02u%s%s", day, sep, month, sep, year);
+                break;
+            case 1:
+                snprintf(date, sizeof(date), "%u%s%u%s%s", month, sep, day, sep, year);
+                break;
+            default:
+                snprintf(date, sizeof(date), "%s%s%02u%s%02u", year, sep, month, sep, day);
+                break;
+            }
+            len = append(buf, len, date, strlen(date));
+        }
+        if (rng() % 2) {
+            word = random_word(words);
+            len = append(buf, len, word, strlen(word));
+        }
+        if (corpus_add(corpus, buf, len) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// walks over adjacent qwerty keys, shifted at times
+static int
+gen_walk(struct corpus *corpus, unsigned int n)
+{
+    static const char *const rows[] = {
+        "1234567890-=", "qwertyuiop[]", "asdfghjkl;'", "zxcvbnm,./",
+    };
+    static const char *const shifted_rows[] = {
+        "!@#$%^&*()_+", "QWERTYUIOP{}", "ASDFGHJKL:\"", "ZXCVBNM<>?",
+    };
+    static const int moves[][2] = {
+        {0, 1}, {0, -1}, {1, 0}, {-1, 0}, {1, -1}, {-1, 1},
+    };
+    char buf[PASSWORD_LEN_MAX];
+    unsigned int i, len, target, shift, dir, k;
+    int row, col, r, c;
+
+    for (i = 0; i < n; ++i) {
+        target = rng_range(6, 16);
+        row = rng() % ARRAY_SIZE(rows);
+        col = rng() % strlen(rows[row]);
+        shift = rng() % 4 == 0;
+        dir = rng() % ARRAY_SIZE(moves);
+        for (len = 0; len < target;) {
+            buf[len++] = (shift ? shifted_rows : rows)[row][col];
+            if (rng() % 8 == 0)
+                shift = !shift;
+            // keep the direction mostly, turn when blocked
+            if (rng() % 4 == 0)
+                dir = rng() % ARRAY_SIZE(moves);
+            for (k = 0; k < 8; ++k, dir = rng() % ARRAY_SIZE(moves)) {
+                r = row + moves[dir][0];
+                c = col + moves[dir][1];
+                if (r >= 0 && r < ARRAY_SIZE(rows) && c >= 0 && c < strlen(rows[r])) {
+                    row = r;
+                    col = c;
+                    break;
+                }
+            }
+        }
+        if (corpus_add(corpus, buf, len) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Corpora ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Bench ==================================================================== */
+
+/*
+ * The time of a matcher is the difference between the corpus matched with it
+ * and without it. Stages are also timed by the library in a pass of their own,
+ * as timing them slows matching down.
+ */
+struct config {
+    unsigned int skipped_match_types;
+    int dicts;
+    int stats;
+    struct zxcvbn *zxcvbn;
+    double time;
+};
+
+enum {
+    CONFIG_ALL,
+    CONFIG_NO_SPATIAL,
+    CONFIG_NO_DIGITS,
+    CONFIG_NO_DATE,
+    CONFIG_NO_SEQUENCE,
+    CONFIG_NO_BREACH,
+    CONFIG_NO_DICT,
+    CONFIG_NO_DICT_REPEAT,
+    CONFIG_MAX,
+};
+
+static struct config configs[CONFIG_MAX] = {
+    [CONFIG_ALL]            = {0, 1},
+    [CONFIG_NO_SPATIAL]     = {ZXCVBN_MATCH_TYPE_SPATIAL_M, 1},
+    [CONFIG_NO_DIGITS]      = {ZXCVBN_MATCH_TYPE_DIGITS_M, 1},
+    [CONFIG_NO_DATE]        = {ZXCVBN_MATCH_TYPE_DATE_M, 1},
+    [CONFIG_NO_SEQUENCE]    = {ZXCVBN_MATCH_TYPE_SEQUENCE_M, 1},
+    [CONFIG_NO_BREACH]      = {ZXCVBN_MATCH_TYPE_BREACH_M, 1},
+    [CONFIG_NO_DICT]        = {0, 0},
+    // dictionaries are skipped with repeats
+    [CONFIG_NO_DICT_REPEAT] = {ZXCVBN_MATCH_TYPE_REPEAT_M, 0},
+};
+
+static struct config stats_config = {.dicts = 1, .stats = 1};
+
+static const struct {
+    const char *name;
+    int with;
+    int without;
+} matchers[] = {
+    {"spatial",     CONFIG_ALL,         CONFIG_NO_SPATIAL},
+    {"digits",      CONFIG_ALL,         CONFIG_NO_DIGITS},
+    {"date",        CONFIG_ALL,         CONFIG_NO_DATE},
+    {"sequence",    CONFIG_ALL,         CONFIG_NO_SEQUENCE},
+    {"breach",      CONFIG_ALL,         CONFIG_NO_BREACH},
+    {"dict",        CONFIG_ALL,         CONFIG_NO_DICT},
+    {"repeat",      CONFIG_NO_DICT,     CONFIG_NO_DICT_REPEAT},
+};
+
+struct result {
+    unsigned long n_calls;
+    double pw_per_sec;
+    double p50;
+    double p99;
+    double p999;
+    double allocs_per_call;
+    double matcher_ns[ARRAY_SIZE(matchers)];
+    double stage_ns[ZXCVBN_STAGES_NUM];
+    long peak_rss_kb;
+};
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+double_cmp(const void *a, const void *b)
+{
+    const double *x = a, *y = b;
+
+    return *x < *y ? -1 : *x > *y;
+}
+
+static struct zxcvbn *
+config_init(struct config *config, struct zxcvbn *dicts, const char *breach)
+{
+    struct zxcvbn_opts opts;
+    struct zxcvbn *zxcvbn;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.malloc = bench_malloc;
+    opts.realloc = bench_realloc;
+    opts.free = bench_free;
+    opts.symbols = SYMBOLS;
+    opts.skipped_match_types = config->skipped_match_types;
+    opts.stats = config->stats;
+
+    if ((zxcvbn = zxcvbn_init_ex(NULL, &opts)) == NULL) {
+        fprintf(stderr, "zxcvbn_init_ex() failed\n");
+        return NULL;
+    }
+    if (config->dicts && zxcvbn_dict_set_install(zxcvbn, dicts) < 0) {
+        fprintf(stderr, "zxcvbn_dict_set_install() failed\n");
+        goto err;
+    }
+    if (breach && zxcvbn_breach_load_mmap(zxcvbn, breach) == NULL) {
+        fprintf(stderr, "zxcvbn_breach_load_mmap(\"%s\") failed\n", breach);
+        goto err;
+    }
+    config->zxcvbn = zxcvbn;
+    return zxcvbn;
+
+err:
+    zxcvbn_release(zxcvbn);
+    return NULL;
+}
+
+// match every password once, latencies in ns if not NULL
+static int
+run(struct config *config, const struct corpus *corpus, double *latencies)
+{
+    struct zxcvbn_res res;
+    const char *password;
+    unsigned int i;
+    double t;
+
+    for (i = 0; i < corpus->n; ++i) {
+        password = corpus->passwords[i];
+        t = now_ns();
+        zxcvbn_res_init(&res, config->zxcvbn);
+        if (zxcvbn_match(&res, password, strlen(password), NULL, 0) < 0) {
+            fprintf(stderr, "zxcvbn_match(\"%s\") failed\n", password);
+            zxcvbn_res_release(&res);
+            return -1;
+        }
+        zxcvbn_res_release(&res);
+        t = now_ns() - t;
+        config->time += t;
+        if (latencies)
+            latencies[i] = t;
+    }
+    return 0;
+}
+
+static int
+bench(const struct corpus *corpus, unsigned int repeats, struct result *result)
+{
+    struct zxcvbn_stats stats;
+    unsigned long allocs;
+    struct rusage usage;
+    double *latencies;
+    unsigned int c, m, r;
+    size_t n;
+
+    memset(result, 0, sizeof(*result));
+    n = (size_t) corpus->n * repeats;
+    if (n == 0)
+        return 0;
+    if ((latencies = malloc(sizeof(*latencies) * n)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    // a pass to warm up caches and map dictionaries in
+    for (c = 0; c < CONFIG_MAX; ++c) {
+        if (run(configs + c, corpus, NULL) < 0)
+            goto err;
+        configs[c].time = 0;
+    }
+
+    // configs take turns so that drifts of the machine hit all of them
+    allocs = 0;
+    for (r = 0; r < repeats; ++r) {
+        for (c = 0; c < CONFIG_MAX; ++c) {
+            if (c == CONFIG_ALL) {
+                allocs -= n_allocs;
+                if (run(configs + c, corpus, latencies + (size_t) r * corpus->n) < 0)
+                    goto err;
+                allocs += n_allocs;
+            } else if (run(configs + c, corpus, NULL) < 0)
+                goto err;
+        }
+    }
+    result->allocs_per_call = (double) allocs / n;
+
+    qsort(latencies, n, sizeof(*latencies), double_cmp);
+    result->n_calls = n;
+    result->pw_per_sec = n / (configs[CONFIG_ALL].time / 1e9);
+    result->p50 = latencies[n / 2];
+    result->p99 = latencies[MIN(n - 1, n * 99 / 100)];
+    result->p999 = latencies[MIN(n - 1, n * 999 / 1000)];
+    for (m = 0; m < ARRAY_SIZE(matchers); ++m) {
+        result->matcher_ns[m] = (configs[matchers[m].with].time -
+                                 configs[matchers[m].without].time) / n;
+    }
+
+    zxcvbn_stats_reset(stats_config.zxcvbn);
+    if (run(&stats_config, corpus, NULL) < 0)
+        goto err;
+    zxcvbn_stats_get(stats_config.zxcvbn, &stats);
+    for (m = 0; m < ZXCVBN_STAGES_NUM; ++m)
+        result->stage_ns[m] = (double) stats.stage_ns[m] / stats.calls;
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        result->peak_rss_kb = usage.ru_maxrss;
+
+    free(latencies);
+    return 0;
+
+err:
+    free(latencies);
+    return -1;
+}
+
+static void
+print_result(const char *name, const struct result *result, int json)
+{
+    unsigned int m;
+
+    if (json) {
+        printf("{\"corpus\": \"%s\", \"calls\": %lu, \"pw_per_sec\": %.0f, "
+               "\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f, "
+               "\"allocs_per_call\": %.2f, \"peak_rss_kb\": %ld, \"matcher_ns\": {",
+               name, result->n_calls, result->pw_per_sec,
+               result->p50, result->p99, result->p999,
+               result->allocs_per_call, result->peak_rss_kb);
+        for (m = 0; m < ARRAY_SIZE(matchers); ++m)
+            printf("%s\"%s\": %.0f", m ? ", " : "", matchers[m].name, result->matcher_ns[m]);
+        printf("}, \"stage_ns\": {");
+        for (m = 0; m < ZXCVBN_STAGES_NUM; ++m)
+            printf("%s\"%s\": %.0f", m ? ", " : "", zxcvbn_stage_string(m), result->stage_ns[m]);
+        printf("}}\n");
+        return;
+    }
+
+    printf("%-8s %8lu %10.0f %10.2f %10.2f %10.2f %8.2f %10ld\n",
+           name, result->n_calls, result->pw_per_sec,
+           result->p50 / 1e3, result->p99 / 1e3, result->p999 / 1e3,
+           result->allocs_per_call, result->peak_rss_kb);
+    printf("        ");
+    for (m = 0; m < ARRAY_SIZE(matchers); ++m)
+        printf(" %s %.0f ns", matchers[m].name, result->matcher_ns[m]);
+    printf("\n        ");
+    for (m = 0; m < ZXCVBN_STAGES_NUM; ++m)
+        printf(" %s %.0f ns", zxcvbn_stage_string(m), result->stage_ns[m]);
+    printf("\n");
+}
+
+/*
+ * Secrets typed key by key into a session, the time of a key by the length
+ * of the password it makes. A key costs about as much at any length.
+ */
+static const unsigned int typing_lens[] = {64, 256, 1024, 4096, PASSWORD_LEN_MAX};
+
+struct typing_result {
+    unsigned long n_keys[ARRAY_SIZE(typing_lens)];
+    double key_ns[ARRAY_SIZE(typing_lens)];
+};
+
+static int
+bench_typing(const struct corpus *corpus, struct typing_result *result)
+{
+    struct zxcvbn_session session;
+    const char *password;
+    unsigned int i, k, b, len;
+    double t;
+
+    memset(result, 0, sizeof(*result));
+    zxcvbn_session_init(configs[CONFIG_ALL].zxcvbn, &session, NULL, 0, NULL, 0);
+    for (i = 0; i < corpus->n; ++i) {
+        password = corpus->passwords[i];
+        len = strlen(password);
+        for (k = 0, b = 0; k < len; ++k) {
+            t = now_ns();
+            if (zxcvbn_session_append(&session, password + k, 1) < 0) {
+                fprintf(stderr, "zxcvbn_session_append() failed\n");
+                zxcvbn_session_release(&session);
+                return -1;
+            }
+            t = now_ns() - t;
+            while (k >= typing_lens[b])
+                b++;
+            result->n_keys[b]++;
+            result->key_ns[b] += t;
+        }
+        zxcvbn_session_truncate(&session, 0);
+    }
+    zxcvbn_session_release(&session);
+
+    for (b = 0; b < ARRAY_SIZE(typing_lens); ++b) {
+        if (result->n_keys[b])
+            result->key_ns[b] /= result->n_keys[b];
+    }
+    return 0;
+}
+
+static void
+print_typing(const struct typing_result *result, int json)
+{
+    unsigned int b;
+
+    if (json) {
+        printf("{\"corpus\": \"typing\", \"key_ns\": {");
+        for (b = 0; b < ARRAY_SIZE(typing_lens); ++b)
+            printf("%s\"%u\": %.0f", b ? ", " : "", typing_lens[b], result->key_ns[b]);
+        printf("}}\n");
+        return;
+    }
+
+    printf("%-8s", "typing");
+    for (b = 0; b < ARRAY_SIZE(typing_lens); ++b)
+        printf(" up to %u %.0f ns/key", typing_lens[b], result->key_ns[b]);
+    printf("\n");
+}
+
+/* Bench ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+static void
+print_usage()
+{
+    printf("Usage: zxcvbn_bench [ -h ] [ -D dict ] [ -M image ] [ -B image ] [ -p passwords ] [ -c corpus,... ]\n");
+    printf("                    [ -n N ] [ -r N ] [ -s seed ] [ -o text|json ]\n");
+    printf("       -D dict: load ranked dictionary, -M image: map saved dictionary, -B image: map breach corpus\n");
+    printf("       -p file: passwords of the common corpus (common_passwords.txt)\n");
+    printf("       -c common,long,dict,date,walk,secret,typing: corpora to run, all by default,\n");
+    printf("          typing: secrets typed key by key into a session\n");
+    printf("       -n N: passwords per synthetic corpus (10000), -r N: passes over each corpus (3)\n");
+    printf("       -s seed: of synthetic corpora, -o json: a JSON object per corpus\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    static const char *const names[] = {"common", "long", "dict", "date", "walk", "secret"};
+    struct corpus corpora[ARRAY_SIZE(names)];
+    const char *passwords_path, *breach, *selected;
+    struct words words, dict_words;
+    struct zxcvbn_dict *dict;
+    struct zxcvbn_opts opts;
+    struct typing_result typing;
+    struct result result;
+    struct zxcvbn *dicts;
+    unsigned int i, n, repeats, first;
+    int opt, json, ret;
+
+    passwords_path = "common_passwords.txt";
+    breach = NULL;
+    selected = NULL;
+    n = 10000;
+    repeats = 3;
+    json = 0;
+    rng_state = 0x9e3779b97f4a7c15ULL;
+    memset(&words, 0, sizeof(words));
+    memset(&dict_words, 0, sizeof(dict_words));
+    memset(corpora, 0, sizeof(corpora));
+
+    memset(&opts, 0, sizeof(opts));
+    opts.malloc = bench_malloc;
+    opts.realloc = bench_realloc;
+    opts.free = bench_free;
+    opts.symbols = SYMBOLS;
+    if ((dicts = zxcvbn_init_ex(NULL, &opts)) == NULL) {
+        fprintf(stderr, "zxcvbn_init_ex() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    while ((opt = getopt(argc, argv, "hD:M:B:p:c:n:r:s:o:")) != -1) {
+        switch (opt) {
+        case 'h':
+            print_usage();
+            return EXIT_SUCCESS;
+
+        case 'D':
+            first = dict_words.n;
+            dict = zxcvbn_dict_init(dicts, NULL, optarg);
+            if (dict == NULL || read_lines(optarg, NULL, &dict_words) < 0) {
+                fprintf(stderr, "loading \"%s\" failed\n", optarg);
+                return EXIT_FAILURE;
+            }
+            for (i = first; i < dict_words.n; ++i) {
+                if (zxcvbn_dict_add_word(dict, dict_words.words[i],
+                                         strlen(dict_words.words[i]), i - first + 1) < 0) {
+                    fprintf(stderr, "zxcvbn_dict_add_word(\"%s\") failed\n", optarg);
+                    return EXIT_FAILURE;
+                }
+            }
+            break;
+
+        case 'M':
+            if (zxcvbn_dict_load_mmap(dicts, NULL, optarg, optarg) == NULL) {
+                fprintf(stderr, "zxcvbn_dict_load_mmap(\"%s\") failed\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'B':
+            breach = optarg;
+            break;
+
+        case 'p':
+            passwords_path = optarg;
+            break;
+
+        case 'c':
+            selected = optarg;
+            break;
+
+        case 'n':
+            n = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            repeats = strtoul(optarg, NULL, 10);
+            break;
+
+        case 's':
+            rng_state = strtoull(optarg, NULL, 0) | 1;
+            break;
+
+        case 'o':
+            json = strcmp(optarg, "json") == 0;
+            break;
+
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (zxcvbn_dict_compile(dicts) < 0) {
+        fprintf(stderr, "zxcvbn_dict_compile() failed\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < CONFIG_MAX; ++i) {
+        if (config_init(configs + i, dicts, breach) == NULL)
+            return EXIT_FAILURE;
+    }
+    if (config_init(&stats_config, dicts, breach) == NULL)
+        return EXIT_FAILURE;
+
+    // synthetic corpora are made of dictionary words, else of common passwords
+    if (read_lines(passwords_path, corpora + 0, dict_words.n ? NULL : &words) < 0)
+        return EXIT_FAILURE;
+    if (dict_words.n)
+        words = dict_words;
+    if (words.n == 0) {
+        fprintf(stderr, "no words for synthetic corpora\n");
+        return EXIT_FAILURE;
+    }
+    // secrets of 1..8 KB are fewer, each costs as much as many passwords
+    if (gen_long(corpora + 1, &words, n, 64, 256) < 0 ||
+            gen_dict(corpora + 2, &words, n) < 0 ||
+            gen_date(corpora + 3, &words, n) < 0 ||
+            gen_walk(corpora + 4, n) < 0 ||
+            gen_long(corpora + 5, &words, MAX(n / 32, 1), 1024, PASSWORD_LEN_MAX) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!json) {
+        printf("%-8s %8s %10s %10s %10s %10s %8s %10s\n", "corpus", "calls", "pw/s",
+               "p50 us", "p99 us", "p999 us", "allocs", "rss kb");
+    }
+
+    ret = EXIT_SUCCESS;
+    for (i = 0; i < ARRAY_SIZE(names); ++i) {
+        corpora[i].name = names[i];
+        if (selected && !strstr(selected, names[i]))
+            continue;
+        if (bench(corpora + i, repeats, &result) < 0) {
+            ret = EXIT_FAILURE;
+            break;
+        }
+        print_result(names[i], &result, json);
+    }
+    if (ret == EXIT_SUCCESS && (!selected || strstr(selected, "typing"))) {
+        // the secret corpus
+        if (bench_typing(corpora + 5, &typing) < 0)
+            ret = EXIT_FAILURE;
+        else
+            print_typing(&typing, json);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(names); ++i)
+        corpus_release(corpora + i);
+    for (i = 0; i < words.n; ++i)
+        free(words.words[i]);
+    free(words.words);
+    for (i = 0; i < CONFIG_MAX; ++i)
+        zxcvbn_release(configs[i].zxcvbn);
+    zxcvbn_release(stats_config.zxcvbn);
+    zxcvbn_release(dicts);
+
+    return ret;
+}
@@ -4,6 +4,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include "zxcvbn.h"
 
@@ -77,19 +78,131 @@ err:
     return NULL;
 }
 
+/* arg is "list,image": save passwords of list, one per line, as an image */
+static int
+save_breach(struct zxcvbn *zxcvbn, char *arg)
+{
+    struct zxcvbn_breach *breach;
+    char buf[1024], *path;
+    unsigned int rank;
+    size_t len;
+    FILE *file;
+
+    if ((path = strchr(arg, ',')) == NULL) {
+        fprintf(stderr, "breach corpus \"%s\" is not list,image\n", arg);
+        return -1;
+    }
+    *path++ = '\0';
+
+    if ((file = fopen(arg, "r")) == NULL) {
+        fprintf(stderr, "fopen(\"%s\") failed (%d:%s)\n", arg, errno, strerror(errno));
+        return -1;
+    }
+    if ((breach = zxcvbn_breach_init(zxcvbn)) == NULL) {
+        fprintf(stderr, "zxcvbn_breach_init() failed\n");
+        fclose(file);
+        return -1;
+    }
+
+    // spaces are part of passwords, only line ends are cut
+    rank = 1;
+    while (fgets(buf, sizeof(buf), file) != NULL) {
+        len = strcspn(buf, "\r\n");
+        if (len == 0)
+            continue;
+        if (zxcvbn_breach_add(breach, buf, len, rank++) < 0) {
+            fprintf(stderr, "zxcvbn_breach_add(\"%.*s\") failed\n", (int) len, buf);
+            goto err;
+        }
+    }
+
+    if (zxcvbn_breach_save(breach, path) < 0) {
+        fprintf(stderr, "zxcvbn_breach_save(\"%s\") failed\n", path);
+        goto err;
+    }
+
+    zxcvbn_breach_release(breach);
+    fclose(file);
+    return 0;
+
+err:
+    zxcvbn_breach_release(breach);
+    fclose(file);
+    return -1;
+}
+
+#define LAYOUT_SIZE_MAX     4096
+
+// keyboard layout named by the file name without extension
+static int
+read_layout(struct zxcvbn *zxcvbn, const char *path)
+{
+    char desc[LAYOUT_SIZE_MAX], name[NAME_MAX], *ext;
+    const char *base;
+    size_t len;
+    FILE *file;
+
+    base = strrchr(path, '/');
+    snprintf(name, sizeof(name), "%s", base != NULL ? base + 1 : path);
+    if ((ext = strrchr(name, '.')) != NULL && ext != name)
+        *ext = '\0';
+
+    if ((file = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "fopen(\"%s\") failed (%d:%s)\n", path, errno, strerror(errno));
+        return -1;
+    }
+    len = fread(desc, 1, sizeof(desc) - 1, file);
+    fclose(file);
+    desc[len] = '\0';
+
+    if (zxcvbn_layout_add(zxcvbn, name, desc, 0) < 0) {
+        fprintf(stderr, "zxcvbn_layout_add(\"%s\") failed\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+// names separated by commas, other layouts are deactivated
+static int
+select_layouts(struct zxcvbn *zxcvbn, char *names)
+{
+    unsigned int g;
+    char *name, *save;
+
+    for (g = 0; g < zxcvbn->n_layouts; ++g)
+        zxcvbn_layout_set_active(zxcvbn, zxcvbn->layouts[g]->name, 0);
+
+    for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        if (zxcvbn_layout_set_active(zxcvbn, name, 1) < 0) {
+            fprintf(stderr, "zxcvbn_layout_set_active(\"%s\") failed\n", name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 static void
 print_usage()
 {
     printf("Usage: zxcvbn_cli [ -h ] [ -t \"31-12-2000 30-11-1999 ...\" ] [ -d \"word0 word1 ... wordN\" ] { password0 } [ password1 ] ... [ passwordN]\n");
+    printf("       -D dict: load ranked dictionary, -S image: save last loaded dictionary, -M image: map saved dictionary\n");
+    printf("       -P set: publish loaded dictionaries as shared set, -A set: attach shared set\n");
+    printf("       -L file: load keyboard layout, -l name,...: use only these layouts\n");
+    printf("       -C list,image: save ranked passwords as breach corpus, -B image: map breach corpus\n");
+    printf("       -b: score passwords from stdin, -j N: with N threads\n");
 }
 
+#define ESCAPE_MAX      128
+
 static char *
-escape_quotes(char *str)
+escape_quotes(char *buf, const char *str)
 {
-    static char buf[128];
     unsigned int i;
 
-    for (i = 0; *str && i < sizeof(buf) - 1; str++) {
+    // buf holds ESCAPE_MAX + 1 chars, the last char may be escaped
+    for (i = 0; *str && i < ESCAPE_MAX - 1; str++) {
         if (strchr("\"\\", *str))
             buf[i++] = '\\';
         buf[i++] = *str;
@@ -98,17 +211,245 @@ escape_quotes(char *str)
     return buf;
 }
 
-static void
-process_bulk(int argc, char **argv)
+#define BULK_LINE_SIZE          1024
+#define BULK_OUT_SIZE           (ESCAPE_MAX + 64)
+#define BULK_CHUNK_LINES        64
+#define BULK_ARENA_CANDIDATES   512
+// candidate columns of a worker, in 64-bit words to keep them aligned
+#define BULK_ARENA_WORDS \
+    ((BULK_ARENA_CANDIDATES * ZXCVBN_CANDIDATE_SIZE + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+
+/*
+ * Score one line of bulk input: password and user words separated by
+ * spaces. The line is cut after the password. res is reused between lines.
+ */
+static int
+bulk_score(struct zxcvbn *z, struct zxcvbn_res *res, char *line, char *out)
 {
-    char buf[1024], *words[256], *p;
+    char esc[ESCAPE_MAX + 1], *p, *save;
+    const char *words[256];
     struct timeval st, et;
     unsigned int words_num;
+    size_t len;
+    long t;
+
+    words_num = 0;
+    len = strlen(line);
+    if (line[len - 1] == '\n')
+        line[len - 1] = '\0';
+    p = strchr(line, ' ');
+    if (p) {
+        *p = '\0';
+        for (p = strtok_r(p + 1, " ", &save); p; p = strtok_r(NULL, " ", &save)) {
+            if (words_num == ARRAY_SIZE(words))
+                break;
+            words[words_num++] = p;
+        }
+    }
+
+    zxcvbn_res_reset(res);
+    gettimeofday(&st, NULL);
+    if (zxcvbn_match(res, line, strlen(line),
+                     words, words_num) < 0) {
+        snprintf(out, BULK_OUT_SIZE, "{\"password\": \"%s\", \"error\": true}\n",
+                 escape_quotes(esc, line));
+        return -1;
+    }
+    gettimeofday(&et, NULL);
+    t = (et.tv_sec - st.tv_sec) * 1000000 + et.tv_usec - st.tv_usec;
+    snprintf(out, BULK_OUT_SIZE, "{\"password\": \"%s\", \"entropy\": %.1lf, \"time\": %lu}\n",
+             escape_quotes(esc, line), res->entropy, t);
+    return 0;
+}
+
+static void
+bulk_print(char *line, char *out, int failed)
+{
+    char esc[ESCAPE_MAX + 1];
+
+    fputs(out, stdout);
+    if (failed)
+        fprintf(stderr, "zxcvbn_match(\"%s\") failed\n", escape_quotes(esc, line));
+}
+
+enum {
+    BULK_CHUNK_FREE,
+    BULK_CHUNK_READY,
+    BULK_CHUNK_DONE,
+};
+
+struct bulk_chunk {
+    int state;
+    unsigned int n_lines;
+    char lines[BULK_CHUNK_LINES][BULK_LINE_SIZE];
+    char out[BULK_CHUNK_LINES][BULK_OUT_SIZE];
+    char failed[BULK_CHUNK_LINES];
+};
+
+/*
+ * Chunk n of input goes to chunks[n % n_chunks]. The reader fills free
+ * chunks, workers score ready chunks in input order and the writer prints
+ * done chunks in input order, so the output is the same as in serial mode.
+ */
+struct bulk {
+    struct zxcvbn *z;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t done;
+    pthread_cond_t free;
+    struct bulk_chunk *chunks;
+    unsigned int n_chunks;
+    unsigned long n_read;
+    unsigned long n_taken;
+    int eof;
+};
+
+static void *
+bulk_worker(void *arg)
+{
+    uint64_t arena[BULK_ARENA_WORDS];
+    struct bulk *bulk = arg;
+    struct bulk_chunk *chunk;
+    struct zxcvbn_res res;
+    unsigned int i;
+
+    zxcvbn_res_init_arena(&res, bulk->z, arena, sizeof(arena));
+
+    pthread_mutex_lock(&bulk->lock);
+    for (;;) {
+        while (bulk->n_taken == bulk->n_read && !bulk->eof)
+            pthread_cond_wait(&bulk->ready, &bulk->lock);
+        if (bulk->n_taken == bulk->n_read)
+            break;
+        chunk = bulk->chunks + bulk->n_taken++ % bulk->n_chunks;
+        pthread_mutex_unlock(&bulk->lock);
+
+        for (i = 0; i < chunk->n_lines; ++i)
+            chunk->failed[i] = bulk_score(bulk->z, &res, chunk->lines[i], chunk->out[i]) < 0;
+
+        pthread_mutex_lock(&bulk->lock);
+        chunk->state = BULK_CHUNK_DONE;
+        pthread_cond_signal(&bulk->done);
+    }
+    pthread_mutex_unlock(&bulk->lock);
+    zxcvbn_res_release(&res);
+
+    return NULL;
+}
+
+static void *
+bulk_writer(void *arg)
+{
+    struct bulk *bulk = arg;
+    struct bulk_chunk *chunk;
+    unsigned long n;
+    unsigned int i;
+
+    for (n = 0;; ++n) {
+        chunk = bulk->chunks + n % bulk->n_chunks;
+
+        pthread_mutex_lock(&bulk->lock);
+        while (!(n < bulk->n_read && chunk->state == BULK_CHUNK_DONE) &&
+                !(bulk->eof && n == bulk->n_read))
+            pthread_cond_wait(&bulk->done, &bulk->lock);
+        if (n == bulk->n_read) {
+            pthread_mutex_unlock(&bulk->lock);
+            break;
+        }
+        pthread_mutex_unlock(&bulk->lock);
+
+        for (i = 0; i < chunk->n_lines; ++i)
+            bulk_print(chunk->lines[i], chunk->out[i], chunk->failed[i]);
+
+        pthread_mutex_lock(&bulk->lock);
+        chunk->state = BULK_CHUNK_FREE;
+        pthread_cond_signal(&bulk->free);
+        pthread_mutex_unlock(&bulk->lock);
+    }
+
+    return NULL;
+}
+
+static void
+process_bulk_threads(struct zxcvbn *z, unsigned int n_threads)
+{
+    struct bulk bulk;
+    struct bulk_chunk *chunk;
+    pthread_t *threads;
+    unsigned int i, n;
+
+    memset(&bulk, 0, sizeof(bulk));
+    bulk.z = z;
+    bulk.n_chunks = 4 * n_threads;
+    pthread_mutex_init(&bulk.lock, NULL);
+    pthread_cond_init(&bulk.ready, NULL);
+    pthread_cond_init(&bulk.done, NULL);
+    pthread_cond_init(&bulk.free, NULL);
+
+    if ((bulk.chunks = calloc(bulk.n_chunks, sizeof(*bulk.chunks))) == NULL ||
+            (threads = calloc(n_threads + 1, sizeof(*threads))) == NULL) {
+        fprintf(stderr, "calloc() failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < n_threads + 1; ++i) {
+        if (pthread_create(threads + i, NULL, i < n_threads ? bulk_worker : bulk_writer, &bulk) != 0) {
+            fprintf(stderr, "pthread_create() failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (;;) {
+        chunk = bulk.chunks + bulk.n_read % bulk.n_chunks;
+
+        pthread_mutex_lock(&bulk.lock);
+        while (chunk->state != BULK_CHUNK_FREE)
+            pthread_cond_wait(&bulk.free, &bulk.lock);
+        pthread_mutex_unlock(&bulk.lock);
+
+        for (n = 0; n < BULK_CHUNK_LINES; ++n) {
+            if (!fgets(chunk->lines[n], BULK_LINE_SIZE, stdin))
+                break;
+        }
+        chunk->n_lines = n;
+
+        // workers don't hold the set across chunks, so it is replaced here
+        if (z->dict_set != NULL && zxcvbn_dict_set_refresh(z) < 0)
+            fprintf(stderr, "zxcvbn_dict_set_refresh() failed\n");
+
+        pthread_mutex_lock(&bulk.lock);
+        if (n > 0) {
+            chunk->state = BULK_CHUNK_READY;
+            ++bulk.n_read;
+            pthread_cond_signal(&bulk.ready);
+        }
+        if (n < BULK_CHUNK_LINES) {
+            bulk.eof = 1;
+            pthread_cond_broadcast(&bulk.ready);
+            pthread_cond_broadcast(&bulk.done);
+        }
+        pthread_mutex_unlock(&bulk.lock);
+
+        if (n < BULK_CHUNK_LINES)
+            break;
+    }
+
+    for (i = 0; i < n_threads + 1; ++i)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    free(bulk.chunks);
+}
+
+static void
+process_bulk(int argc, char **argv)
+{
+    char buf[BULK_LINE_SIZE], out[BULK_OUT_SIZE];
+    uint64_t arena[BULK_ARENA_WORDS];
+    unsigned int n_threads;
     struct zxcvbn_res res;
     struct zxcvbn *z;
-    size_t len;
     int opt;
-    long t;
 
     if (!(z = zxcvbn_init(NULL, NULL, NULL, NULL,
                           "!@#$%^&*()-_+=;:,./?\\|`~[]{}"))) {
@@ -116,47 +457,62 @@ process_bulk(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    n_threads = 0;
     optind = 1;
     opterr = 0;
-    while ((opt = getopt(argc, argv, "D:")) != -1) {
+    while ((opt = getopt(argc, argv, "D:M:A:B:L:l:j:")) != -1) {
         switch (opt) {
             case 'D':
                 if (!read_ranked(z, NULL, optarg, optarg))
                     exit(EXIT_FAILURE);
                 break;
+            case 'M':
+                if (!zxcvbn_dict_load_mmap(z, NULL, optarg, optarg)) {
+                    fprintf(stderr, "zxcvbn_dict_load_mmap(\"%s\") failed\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'A':
+                if (zxcvbn_dict_set_attach(z, optarg) < 0) {
+                    fprintf(stderr, "zxcvbn_dict_set_attach(\"%s\") failed\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'B':
+                if (!zxcvbn_breach_load_mmap(z, optarg)) {
+                    fprintf(stderr, "zxcvbn_breach_load_mmap(\"%s\") failed\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'L':
+                if (read_layout(z, optarg) < 0)
+                    exit(EXIT_FAILURE);
+                break;
+            case 'l':
+                if (select_layouts(z, optarg) < 0)
+                    exit(EXIT_FAILURE);
+                break;
+            case 'j':
+                n_threads = strtoul(optarg, NULL, 10);
+                break;
         }
     }
 
-    while (fgets(buf, sizeof(buf), stdin)) {
-        words_num = 0;
-        len = strlen(buf);
-        if (buf[len - 1] == '\n')
-            buf[len - 1] = '\0';
-        p = strchr(buf, ' ');
-        if (p) {
-            *p = '\0';
-            for (p = strtok(p + 1, " "); p; p = strtok(NULL, " ")) {
-                if (words_num == ARRAY_SIZE(words))
-                    break;
-                words[words_num++] = p;
-            }
-        }
+    if (zxcvbn_dict_compile(z) < 0) {
+        fprintf(stderr, "zxcvbn_dict_compile() failed\n");
+        exit(EXIT_FAILURE);
+    }
 
-        zxcvbn_res_init(&res, z);
-        gettimeofday(&st, NULL);
-        if (zxcvbn_match(&res, buf, strlen(buf),
-                         words, words_num) < 0) {
-            printf("{\"password\": \"%s\", \"error\": true}\n",
-                   escape_quotes(buf));
-            fprintf(stderr, "zxcvbn_match(\"%s\") failed\n",
-                    escape_quotes(buf));
-            zxcvbn_res_release(&res);
-            continue;
+    if (n_threads > 0)
+        process_bulk_threads(z, n_threads);
+    else {
+        zxcvbn_res_init_arena(&res, z, arena, sizeof(arena));
+        while (fgets(buf, sizeof(buf), stdin)) {
+            if (z->dict_set != NULL && zxcvbn_dict_set_refresh(z) < 0)
+                fprintf(stderr, "zxcvbn_dict_set_refresh() failed\n");
+
+            bulk_print(buf, out, bulk_score(z, &res, buf, out) < 0);
         }
-        gettimeofday(&et, NULL);
-        t = (et.tv_sec - st.tv_sec) * 1000000 + et.tv_usec - st.tv_usec;
-        printf("{\"password\": \"%s\", \"entropy\": %.1lf, \"time\": %lu}\n",
-               escape_quotes(buf), res.entropy, t);
         zxcvbn_res_release(&res);
     }
     if (ferror(stdin)) {
@@ -184,7 +540,8 @@ int
 main(int argc, char **argv)
 {
     const char *password;
-    char *dict_words[256], *dict_word, *str;
+    const char *dict_words[256];
+    char *dict_word, *str;
     unsigned int n_dict_words, dates_num;
     int i, opt;
     struct timeval tv0, tv1;
@@ -193,8 +550,10 @@ main(int argc, char **argv)
     struct zxcvbn_res res;
     struct zxcvbn_match *match;
     struct zxcvbn_date dates[32];
+    struct zxcvbn_dict *dict;
 
     n_dict_words = 0;
+    dict = NULL;
     dates_num = 0;
 
     if ((zxcvbn = zxcvbn_init(&zxcvbn_buf, NULL, NULL, NULL, "!@#$%^&*()-_+=;:,./?\\|`~[]{}")) == NULL) {
@@ -202,7 +561,7 @@ main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    while ((opt = getopt(argc, argv, "D:hd:bt:")) != -1) {
+    while ((opt = getopt(argc, argv, "D:M:S:P:A:B:C:L:l:hd:bt:j:")) != -1) {
         switch (opt) {
         case 'h':
             print_usage();
@@ -228,8 +587,55 @@ main(int argc, char **argv)
             process_bulk(argc, argv);
             return EXIT_SUCCESS;
 
+        case 'j':
+            break;
+
         case 'D':
-            read_ranked(zxcvbn, NULL, optarg, optarg);
+            dict = read_ranked(zxcvbn, NULL, optarg, optarg);
+            break;
+
+        case 'M':
+            if ((dict = zxcvbn_dict_load_mmap(zxcvbn, NULL, optarg, optarg)) == NULL)
+                fprintf(stderr, "zxcvbn_dict_load_mmap(\"%s\") failed\n", optarg);
+            break;
+
+        case 'S':
+            if (dict == NULL || zxcvbn_dict_save(dict, optarg) < 0) {
+                fprintf(stderr, "zxcvbn_dict_save(\"%s\") failed\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'P':
+            if (zxcvbn_dict_set_publish(zxcvbn, optarg) < 0) {
+                fprintf(stderr, "zxcvbn_dict_set_publish(\"%s\") failed\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'A':
+            if (zxcvbn_dict_set_attach(zxcvbn, optarg) < 0)
+                fprintf(stderr, "zxcvbn_dict_set_attach(\"%s\") failed\n", optarg);
+            break;
+
+        case 'B':
+            if (zxcvbn_breach_load_mmap(zxcvbn, optarg) == NULL)
+                fprintf(stderr, "zxcvbn_breach_load_mmap(\"%s\") failed\n", optarg);
+            break;
+
+        case 'C':
+            if (save_breach(zxcvbn, optarg) < 0)
+                return EXIT_FAILURE;
+            break;
+
+        case 'L':
+            if (read_layout(zxcvbn, optarg) < 0)
+                return EXIT_FAILURE;
+            break;
+
+        case 'l':
+            if (select_layouts(zxcvbn, optarg) < 0)
+                return EXIT_FAILURE;
             break;
 
         default:
@@ -244,6 +650,11 @@ main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    if (zxcvbn_dict_compile(zxcvbn) < 0) {
+        fprintf(stderr, "zxcvbn_dict_compile() failed\n");
+        return EXIT_FAILURE;
+    }
+
     for (i = optind; argv[i] != NULL; ++i) {
         password = argv[i];
 
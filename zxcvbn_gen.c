@@ -0,0 +1,539 @@
+/*
+ * Generates zxcvbn_tables.h: spatial graphs of keyboard layouts, entropy
+ * tables and l33t substitutions as static const tables, so that nothing of
+ * it has to be built by zxcvbn_init().
+ *
+ * Usage: zxcvbn_gen > zxcvbn_tables.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "zxcvbn.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+/* Spatial graphs =========================================================== */
+
+static unsigned int
+get_align_coords(int coords[2][8], int x, int y)
+{
+    coords[0][0] = x - 1;
+    coords[1][0] = y;
+
+    coords[0][1] = x - 1;
+    coords[1][1] = y - 1;
+
+    coords[0][2] = x;
+    coords[1][2] = y - 1;
+
+    coords[0][3] = x + 1;
+    coords[1][3] = y - 1;
+
+    coords[0][4] = x + 1;
+    coords[1][4] = y;
+
+    coords[0][5] = x + 1;
+    coords[1][5] = y + 1;
+
+    coords[0][6] = x;
+    coords[1][6] = y + 1;
+
+    coords[0][7] = x - 1;
+    coords[1][7] = y + 1;
+
+    return 8;
+}
+
+static unsigned int
+get_slant_coords(int coords[2][8], int x, int y)
+{
+    coords[0][0] = x - 1;
+    coords[1][0] = y;
+
+    coords[0][1] = x;
+    coords[1][1] = y - 1;
+
+    coords[0][2] = x + 1;
+    coords[1][2] = y - 1;
+
+    coords[0][3] = x + 1;
+    coords[1][3] = y;
+
+    coords[0][4] = x;
+    coords[1][4] = y + 1;
+
+    coords[0][5] = x - 1;
+    coords[1][5] = y + 1;
+
+    return 6;
+}
+
+static void
+make_spatial_graph_iter(struct zxcvbn_spatial_graph *spatial_graph,
+                        const char **kb,
+                        unsigned int x_size, unsigned int y_size,
+                        unsigned int token_size, unsigned int n_coords,
+                        unsigned int get_coords(int coords[2][8], int x, int y))
+{
+#define  KB_XY(x, y) ((void *) kb[x_size *y + x])
+
+    int x, y, i, coords[2][8], k, n_coords_get;
+    const unsigned char *s;
+
+    assert(y_size >= 2);
+    assert(x_size <= 16 && y_size <= 8);
+
+    memset(spatial_graph->keys, ZXCVBN_KEY_NONE, sizeof(spatial_graph->keys));
+    memset(spatial_graph->directions, -1, sizeof(spatial_graph->directions));
+
+    // neighbors are at the same offsets for every key, a key is its own
+    // neighbor in the last direction
+    n_coords_get = get_coords(coords, 1, 1);
+    assert(n_coords_get == n_coords);
+    for (i = 0; i < n_coords; ++i)
+        spatial_graph->directions[coords[1][i]][coords[0][i]] = i;
+    spatial_graph->directions[1][1] = n_coords;
+
+    for (y = 1; y < y_size - 1; ++y) {
+        for (x = 1; x < x_size - 1; ++x) {
+            if ((s = KB_XY(x, y)) == NULL)
+                continue;
+
+            get_coords(coords, x, y);
+            for (i = 0; *s != '\0'; ++s, ++i) {
+                assert(i < token_size);
+                ++spatial_graph->n_chars;
+                for (k = 0; k < n_coords; ++k)
+                    if (KB_XY(coords[0][k], coords[1][k]) != NULL)
+                        ++spatial_graph->degree;
+                assert(*s < ARRAY_SIZE(spatial_graph->keys));
+                spatial_graph->keys[*s] = y << 4 | x | (i > 0 ? ZXCVBN_KEY_SHIFTED : 0);
+            }
+        }
+    }
+
+    spatial_graph->degree /= spatial_graph->n_chars;
+
+#undef KB_XY
+}
+
+static void
+make_spatial_graph(struct zxcvbn_spatial_graph spatial_graphs[4])
+{
+#define KEYBRD_X_SIZE 16
+#define KEYBRD_Y_SIZE 6
+#define KEYPAD_X_SIZE 6
+#define KEYPAD_Y_SIZE 7
+
+    static const char *qwerty[KEYBRD_Y_SIZE][KEYBRD_X_SIZE] = {
+        { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,  NULL, NULL,  NULL },
+        { NULL, "`~", "1!", "2@", "3#", "4$", "5%", "6^", "7&", "8*", "9(", "0)", "-_",  "=+", NULL,  NULL },
+        { NULL, NULL, "qQ", "wW", "eE", "rR", "tT", "yY", "uU", "iI", "oO", "pP", "[{",  "]}", "\\|", NULL },
+        { NULL, NULL, "aA", "sS", "dD", "fF", "gG", "hH", "jJ", "kK", "lL", ";:", "'\"", NULL, NULL,  NULL }, 
+        { NULL, NULL, "zZ", "xX", "cC", "vV", "bB", "nN", "mM", ",<", ".>", "/?", NULL,  NULL, NULL,  NULL },
+        { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,  NULL, NULL,  NULL }
+    };
+
+    static const char *dvorak[KEYBRD_Y_SIZE][KEYBRD_X_SIZE] = {
+        { NULL, NULL, NULL,  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,  NULL, },
+        { NULL, "`~", "1!",  "2@", "3#", "4$", "5%", "6^", "7&", "8*", "9(", "0)", "[{", "]}", NULL,  NULL, },
+        { NULL, NULL, "'\"", ",<", ".>", "pP", "yY", "fF", "gG", "cC", "rR", "lL", "/?", "=+", "\\|", NULL, },
+        { NULL, NULL, "aA",  "oO", "eE", "uU", "iI", "dD", "hH", "tT", "nN", "sS", "-_", NULL, NULL,  NULL, },
+        { NULL, NULL, ";:",  "qQ", "jJ", "kK", "xX", "bB", "mM", "wW", "vV", "zZ", NULL, NULL, NULL,  NULL, },
+        { NULL, NULL, NULL,  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,  NULL, },
+    };
+
+    static const char *keypad[KEYPAD_Y_SIZE][KEYPAD_X_SIZE] = {
+        { NULL, NULL, NULL, NULL, NULL, NULL, },
+        { NULL, NULL, "/",  "*",  "-",  NULL, },
+        { NULL, "7",  "8",  "9",  "+",  NULL, },
+        { NULL, "4",  "5",  "6",  NULL, NULL, },
+        { NULL, "1",  "2",  "3",  NULL, NULL, },
+        { NULL, NULL, "0",  ".",  NULL, NULL, },
+        { NULL, NULL, NULL, NULL, NULL, NULL, },
+    };
+
+    static const char *macpad[KEYPAD_Y_SIZE][KEYPAD_X_SIZE] = {
+        { NULL, NULL, NULL, NULL, NULL, NULL, },
+        { NULL, NULL, "=",  "/",  "*",  NULL, },
+        { NULL, "7",  "8",  "9",  "-",  NULL, },
+        { NULL, "4",  "5",  "6",  "+",  NULL, },
+        { NULL, "1",  "2",  "3",  NULL, NULL, },
+        { NULL, "0",  ".",  NULL, NULL, NULL, },
+        { NULL, NULL, NULL, NULL, NULL, NULL, },
+    };
+
+    make_spatial_graph_iter(&spatial_graphs[0],
+                            (const char **) qwerty,
+                            KEYBRD_X_SIZE, KEYBRD_Y_SIZE, 2, 6, get_slant_coords);
+
+    make_spatial_graph_iter(&spatial_graphs[1],
+                            (const char **) dvorak,
+                            KEYBRD_X_SIZE, KEYBRD_Y_SIZE, 2, 6, get_slant_coords);
+
+    make_spatial_graph_iter(&spatial_graphs[2],
+                            (const char **) keypad,
+                            KEYPAD_X_SIZE, KEYPAD_Y_SIZE, 1, 8, get_align_coords);
+
+    make_spatial_graph_iter(&spatial_graphs[3],
+                            (const char **) macpad,
+                            KEYPAD_X_SIZE, KEYPAD_Y_SIZE, 1, 8, get_align_coords);
+
+#undef KEYBRD_X_SIZE
+#undef KEYBRD_Y_SIZE
+#undef KEYPAD_X_SIZE
+#undef KEYPAD_Y_SIZE
+}
+
+
+/* Spatial graphs ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Entropy ================================================================== */
+
+// nCk() and spatial_possibilities() must stay the same as in zxcvbn.c, long
+// matches are computed there in the same way
+static unsigned int
+nCk(unsigned int n, unsigned int k)
+{
+    unsigned int r, d;
+
+    if (k > n)
+        return 0;
+    if (k == 0)
+        return 1;
+
+    r = 1;
+
+    for (d = 1; d <= k; ++d) {
+        r *= n;
+        r /= d;
+        n -= 1;
+    }
+
+    return r;
+}
+
+static double
+spatial_possibilities(struct zxcvbn_spatial_graph *spatial_graph,
+                      double possibilities, unsigned int length, unsigned int turns)
+{
+    unsigned int j, possible_turns;
+
+    possible_turns = turns < length - 1 ? turns : length - 1;
+    for (j = 1; j <= possible_turns; ++j)
+        possibilities += nCk(length - 1, j - 1) * spatial_graph->n_chars * pow(spatial_graph->degree, j);
+
+    return possibilities;
+}
+
+static void
+make_spatial_entropy_table(struct zxcvbn_spatial_graph *spatial_graph)
+{
+    unsigned int length, turns;
+    double possibilities;
+
+    for (turns = 0; turns < ZXCVBN_ENTROPY_TABLE_LEN; ++turns) {
+        possibilities = 0;
+        for (length = 1; length < ZXCVBN_ENTROPY_TABLE_LEN; ++length) {
+            if (length >= 2)
+                possibilities = spatial_possibilities(spatial_graph, possibilities, length, turns);
+            spatial_graph->entropy[length][turns] = log2(possibilities);
+        }
+    }
+}
+
+/* Entropy ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Sequences ================================================================ */
+
+#define ZXCVBN_SEQUENCES_DEF(m) \
+    m("abcdefghijklmnopqrstuvwxyz", 0)          \
+    m("ABCDEFGHIJKLMNOPQRSTUVWXYZ", 1)          \
+    m("f,dult;pbqrkvyjghcnea[wxio]sm'.z", 1)    \
+    m("F<DULT:PBQRKVYJGHCNEA{WXIO}SM\">Z", 2)   \
+    m("abvgdegziyklmnoprstufhc", 1)             \
+    m("ABVGDEGZIYKLMNOPRSTUFHC", 2)             \
+    m("0123456789", 0)                          \
+
+static struct zxcvbn_sequence sequences[] = {
+#define ZXCVBN_M(s,e)   {s, sizeof(s) - 1, e, {0}},
+    ZXCVBN_SEQUENCES_DEF(ZXCVBN_M)
+#undef ZXCVBN_M
+};
+
+// index of the first occurrence of each char
+static void
+make_sequence_index(struct zxcvbn_sequence *seq)
+{
+    unsigned int i;
+
+    assert(seq->len < ZXCVBN_SEQUENCE_NONE);
+    memset(seq->index, ZXCVBN_SEQUENCE_NONE, sizeof(seq->index));
+    for (i = seq->len; i-- > 0; )
+        seq->index[(unsigned char) seq->str[i]] = i;
+}
+
+/* Sequences ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* L33t ===================================================================== */
+
+static int
+l33t(int ch)
+{
+    switch (ch) {
+    case '4':
+    case '@':
+        return 'a';
+    case '8':
+        return 'b';
+    case '(':
+    case '{':
+    case '[':
+    case '<':
+        return 'c';
+    case '3':
+        return 'e';
+    case '6':
+    case '9':
+        return 'g';
+    case '1':
+    case '!':
+    case '|':
+        return 'i';
+    case '0':
+        return 'o';
+    case '$':
+    case '5':
+        return 's';
+    case '+':
+    case '7':
+        return 't';
+    case '%':
+        return 'x';
+    case '2':
+        return 'z';
+    default:
+        return 0;
+    }
+}
+
+/* L33t ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Classes ================================================================== */
+
+static unsigned int
+char_class(int ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ZXCVBN_CLASS_DIGIT;
+    if (ch >= 'a' && ch <= 'z')
+        return ZXCVBN_CLASS_LOWER;
+    if (ch >= 'A' && ch <= 'Z')
+        return ZXCVBN_CLASS_UPPER;
+    if (ch != '\0' && strchr("-._/\\", ch))
+        return ZXCVBN_CLASS_SYMBOL | ZXCVBN_CLASS_SEPARATOR;
+    return ZXCVBN_CLASS_SYMBOL;
+}
+
+/* Classes ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+/* Output =================================================================== */
+
+// doubles are printed in hex so that tables are exactly what was computed
+static void
+print_double(double d)
+{
+    if (isinf(d))
+        printf(d < 0 ? "-INFINITY" : "INFINITY");
+    else
+        printf("%a", d);
+}
+
+static void
+print_doubles(const char *indent, const double *d, unsigned int n)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; ++i) {
+        if (i % 4 == 0)
+            printf("%s", indent);
+        print_double(d[i]);
+        printf(i % 4 == 3 || i == n - 1 ? ",\n" : ", ");
+    }
+}
+
+static void
+print_spatial_graph(const char *name, const struct zxcvbn_spatial_graph *spatial_graph)
+{
+    unsigned int i, j;
+
+    printf("static const struct zxcvbn_spatial_graph spatial_graph_%s = {\n", name);
+    printf("    .name = \"%s\",\n", name);
+
+    printf("    .keys = {\n");
+    for (i = 0; i < ARRAY_SIZE(spatial_graph->keys); ++i) {
+        if (i % 16 == 0)
+            printf("        ");
+        printf("0x%02x%s", spatial_graph->keys[i], i % 16 == 15 ? ",\n" : ", ");
+    }
+    printf("    },\n");
+
+    printf("    .directions = {\n");
+    for (i = 0; i < 3; ++i) {
+        printf("        {");
+        for (j = 0; j < 3; ++j)
+            printf(" %d,", spatial_graph->directions[i][j]);
+        printf(" },\n");
+    }
+    printf("    },\n");
+
+    printf("    .degree = ");
+    print_double(spatial_graph->degree);
+    printf(",\n");
+    printf("    .n_chars = %u,\n", spatial_graph->n_chars);
+
+    printf("    .entropy = {\n");
+    for (i = 0; i < ZXCVBN_ENTROPY_TABLE_LEN; ++i) {
+        printf("        {\n");
+        print_doubles("            ", spatial_graph->entropy[i], ZXCVBN_ENTROPY_TABLE_LEN);
+        printf("        },\n");
+    }
+    printf("    },\n");
+
+    printf("};\n\n");
+}
+
+static void
+print_sequence(unsigned int n, const struct zxcvbn_sequence *seq)
+{
+    const char *s;
+    unsigned int i;
+
+    printf("static const struct zxcvbn_sequence sequence_%u = {\n", n);
+
+    printf("    .str = \"");
+    for (s = seq->str; *s != '\0'; ++s)
+        printf(*s == '"' || *s == '\\' ? "\\%c" : "%c", *s);
+    printf("\",\n");
+    printf("    .len = %u,\n", seq->len);
+    printf("    .extra_entropy = %u,\n", seq->extra_entropy);
+
+    printf("    .index = {\n");
+    for (i = 0; i < ARRAY_SIZE(seq->index); ++i) {
+        if (i % 16 == 0)
+            printf("        ");
+        printf("0x%02x%s", seq->index[i], i % 16 == 15 ? ",\n" : ", ");
+    }
+    printf("    },\n");
+
+    printf("};\n\n");
+}
+
+/* Output ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+int
+main(void)
+{
+    static struct zxcvbn_spatial_graph spatial_graphs[4];
+    static const char *names[ARRAY_SIZE(spatial_graphs)] = {
+        "qwerty", "dvorak", "keypad", "macpad"
+    };
+    static double rank_entropy[ZXCVBN_RANK_TABLE_SIZE];
+    static double case_entropy[ZXCVBN_ENTROPY_TABLE_LEN][ZXCVBN_ENTROPY_TABLE_LEN / 2 + 1];
+    static double digits_entropy[ZXCVBN_ENTROPY_TABLE_LEN];
+    unsigned int i, n, k;
+    double possibilities;
+    uint32_t mask;
+
+    make_spatial_graph(spatial_graphs);
+
+    for (i = 0; i < ARRAY_SIZE(spatial_graphs); ++i)
+        make_spatial_entropy_table(&spatial_graphs[i]);
+
+    for (n = 0; n < ZXCVBN_RANK_TABLE_SIZE; ++n)
+        rank_entropy[n] = log2(n);
+
+    for (n = 0; n < ZXCVBN_ENTROPY_TABLE_LEN; ++n) {
+        possibilities = 0;
+        for (k = 0; k <= n / 2; ++k) {
+            possibilities += nCk(n, k);
+            case_entropy[n][k] = log2(possibilities);
+        }
+        digits_entropy[n] = log2(pow(10, n));
+    }
+
+    for (i = 0; i < ARRAY_SIZE(sequences); ++i)
+        make_sequence_index(&sequences[i]);
+
+    printf("/* generated by zxcvbn_gen, do not edit */\n\n");
+
+    for (i = 0; i < ARRAY_SIZE(spatial_graphs); ++i)
+        print_spatial_graph(names[i], &spatial_graphs[i]);
+
+    /* log2 of ranks, case variations by length and min(upper, lower), digits */
+    printf("static const double rank_entropy_table[%d] = {\n", ZXCVBN_RANK_TABLE_SIZE);
+    print_doubles("    ", rank_entropy, ZXCVBN_RANK_TABLE_SIZE);
+    printf("};\n\n");
+
+    printf("static const double case_entropy_table[%d][%d] = {\n",
+           ZXCVBN_ENTROPY_TABLE_LEN, ZXCVBN_ENTROPY_TABLE_LEN / 2 + 1);
+    for (n = 0; n < ZXCVBN_ENTROPY_TABLE_LEN; ++n) {
+        printf("    {\n");
+        print_doubles("        ", case_entropy[n], ZXCVBN_ENTROPY_TABLE_LEN / 2 + 1);
+        printf("    },\n");
+    }
+    printf("};\n\n");
+
+    printf("static const double digits_entropy_table[%d] = {\n", ZXCVBN_ENTROPY_TABLE_LEN);
+    print_doubles("    ", digits_entropy, ZXCVBN_ENTROPY_TABLE_LEN);
+    printf("};\n\n");
+
+    for (i = 0; i < ARRAY_SIZE(sequences); ++i)
+        print_sequence(i, &sequences[i]);
+
+    printf("static const struct zxcvbn_sequence *const builtin_sequences[%u] = {\n",
+           (unsigned int) ARRAY_SIZE(sequences));
+    for (i = 0; i < ARRAY_SIZE(sequences); ++i)
+        printf("    &sequence_%u,\n", i);
+    printf("};\n\n");
+
+    // mask of the sequences having a char
+    printf("static const uint32_t sequence_masks[256] = {\n");
+    for (i = 0; i < 256; ++i) {
+        mask = 0;
+        for (n = 0; n < ARRAY_SIZE(sequences); ++n) {
+            if (sequences[n].index[i] != ZXCVBN_SEQUENCE_NONE)
+                mask |= (uint32_t) 1 << n;
+        }
+        if (i % 8 == 0)
+            printf("    ");
+        printf("0x%08x%s", mask, i % 8 == 7 ? ",\n" : ", ");
+    }
+    printf("};\n\n");
+
+    // plain letter of a l33t char or 0
+    printf("static const unsigned char l33t_table[256] = {\n");
+    for (i = 0; i < 256; ++i) {
+        if (i % 16 == 0)
+            printf("    ");
+        printf("0x%02x%s", l33t(i), i % 16 == 15 ? ",\n" : ", ");
+    }
+    printf("};\n\n");
+
+    printf("static const uint8_t char_classes[256] = {\n");
+    for (i = 0; i < 256; ++i) {
+        if (i % 16 == 0)
+            printf("    ");
+        printf("0x%02x%s", char_class(i), i % 16 == 15 ? ",\n" : ", ");
+    }
+    printf("};\n");
+
+    return ferror(stdout) || fflush(stdout) != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}